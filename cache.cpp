@@ -3,216 +3,675 @@
 // professor: Kartchner
 
 #include "cache.h"
-// parameterized constructor - takes input and assigns the parameter to the right data members
-Cache::Cache(int size, hash_fn hash, prob_t probing = DEFPOLCY){
-    // stores hash function and probing policy
+#include <cstring>
+#include <chrono>
+#if defined(__AVX2__) && !defined(__SANITIZE_THREAD__)
+#include <immintrin.h>
+#elif defined(__SSE2__) && !defined(__SANITIZE_THREAD__)
+#include <emmintrin.h>
+#endif
+
+// group matching for the SWISS policy
+// each function compares GROUPWIDTH control bytes starting at group and
+// returns a bit mask with bit k set when byte k matches
+// ThreadSanitizer does not know a vector load reads every byte atomically,
+// so thread sanitized builds use the scalar loop
+#if defined(__AVX2__) && !defined(__SANITIZE_THREAD__)
+const int GROUPWIDTH = 32;
+
+static inline unsigned int matchByte(const unsigned char* group, unsigned char value) {
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(group));
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(static_cast<char>(value))));
+}
+
+// empty and deleted are the only control bytes with the high bit set
+static inline unsigned int matchFree(const unsigned char* group) {
+    return _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(group)));
+}
+#elif defined(__SSE2__) && !defined(__SANITIZE_THREAD__)
+const int GROUPWIDTH = 16;
+
+static inline unsigned int matchByte(const unsigned char* group, unsigned char value) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(static_cast<char>(value))));
+}
+
+// empty and deleted are the only control bytes with the high bit set
+static inline unsigned int matchFree(const unsigned char* group) {
+    return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group)));
+}
+#else
+// scalar fallback
+const int GROUPWIDTH = 16;
+
+static inline unsigned int matchByte(const unsigned char* group, unsigned char value) {
+    unsigned int bits = 0;
+    for (int k = 0; k < GROUPWIDTH; k++) {
+        if (__atomic_load_n(group + k, __ATOMIC_RELAXED) == value) {
+            bits |= 1u << k;
+        }
+    }
+    return bits;
+}
+
+static inline unsigned int matchFree(const unsigned char* group) {
+    unsigned int bits = 0;
+    for (int k = 0; k < GROUPWIDTH; k++) {
+        if (!isLive(__atomic_load_n(group + k, __ATOMIC_RELAXED))) {
+            bits |= 1u << k;
+        }
+    }
+    return bits;
+}
+#endif
+
+// the capacities a table can have, each prime about 1.5 times the previous one,
+// with the multiplier that lets fastMod reduce a 32-bit hash without dividing
+// m_mod = floor((2^64 - 1) / m_prime) + 1, computed at compile time
+struct PrimeStep {
+    size_t   m_prime;
+    uint64_t m_mod;
+    constexpr PrimeStep(size_t prime) : m_prime(prime), m_mod(UINT64_C(0xFFFFFFFFFFFFFFFF) / prime + 1) {}
+};
+
+static constexpr PrimeStep PRIMELADDER[] = {
+    101, 151, 227, 347, 521, 787, 1181, 1777, 2671, 4007, 6011, 9029, 13553,
+    20333, 30509, 45763, 68659, 103001, 154501, 231779, 347671, 521519, 782297,
+    1173463, 1760203, 2640317, 3960497, 5940761, 8911141, 13366711, 20050081,
+    30075127, 45112693, 67669079, 101503627, 152255461, 228383273, 342574909,
+    513862367, 770793589, 1156190419, 1734285653, 2601428513, 3902142817,
+    4294967291
+};
+static constexpr int NUMPRIMES = sizeof(PRIMELADDER) / sizeof(PRIMELADDER[0]);
+static_assert(PRIMELADDER[0].m_prime == MINPRIME, "the ladder starts at MINPRIME");
+
+// returns hash % cap using the precomputed multiplier of cap (Lemire's fastmod)
+// cap has to be a ladder prime, they are all below 2^32
+static inline size_t fastMod(unsigned int hash, uint64_t mod, size_t cap) {
+#if defined(__SIZEOF_INT128__)
+    uint64_t lowbits = mod * hash;
+    return static_cast<size_t>((static_cast<unsigned __int128>(lowbits) * cap) >> 64);
+#else
+    (void)mod;
+    return hash % cap;
+#endif
+}
+
+// distance of the bucket pos from the home bucket of hash in a linear probing table
+static inline size_t homeDistance(unsigned int hash, size_t pos, uint64_t mod, size_t cap) {
+    size_t home = fastMod(hash, mod, cap);
+    return (pos >= home) ? pos - home : pos + cap - home;
+}
+
+// the info word of a slot holding id and a key of len bytes
+static inline unsigned int slotInfo(int id, unsigned int len) {
+    return ((len < LONGKEY) ? len : LONGKEY) << IDBITS | static_cast<unsigned int>(id);
+}
+
+// bytes of the key pool a key of len bytes takes, none for a key kept in the slot
+static inline size_t poolBytes(unsigned int len) {
+    if (len <= INLINEKEY) {
+        return 0;
+    }
+    return (len < LONGKEY) ? len : sizeof(len) + len;
+}
+
+// index of the lowest set bit of a non-zero mask
+static inline int lowestBit(unsigned int bits) {
+#if defined(__GNUC__)
+    return __builtin_ctz(bits);
+#else
+    int k = 0;
+    while ((bits & 1u) == 0) {
+        bits >>= 1;
+        k++;
+    }
+    return k;
+#endif
+}
+
+// the probe sequence of a hash in one table, set up once per search
+// the home bucket and the step are derived from the stored hash here, so a
+// chain of any length costs one reduction and then one addition and a
+// conditional subtraction per bucket, the key is never hashed again
+// SWISS moves a group of GROUPWIDTH buckets at a time, ROBINHOOD one bucket
+class ProbeSeq {
+public:
+    ProbeSeq(unsigned int hash, prob_t policy, size_t cap, uint64_t mod)
+        : m_index(fastMod(hash, mod, cap)), m_step(1), m_growth(0), m_width(1), m_probed(0), m_cap(cap) {
+        if (policy == QUADRATIC) {
+            // the ith step is i*i - (i-1)*(i-1) = 2i-1
+            m_growth = 2;
+        } else if (policy == DOUBLEHASH) {
+            // index = ((Hash(key) % TableSize) + i x (11-Hash(key) % 11))) % TableSize
+            m_step = 11 - (hash % 11);
+        } else if (policy == SWISS) {
+            m_step = GROUPWIDTH;
+            m_width = GROUPWIDTH;
+        }
+    }
+    // bucket (or first bucket of the group) the sequence is at
+    size_t index() const {return m_index;}
+    // number of buckets passed so far, the distance from home for ROBINHOOD
+    size_t probed() const {return m_probed;}
+    // number of buckets (SWISS: groups) read so far, counting the current one
+    size_t steps() const {return m_probed / m_width + 1;}
+    // true once the sequence has covered as many buckets as the table has
+    bool done() const {return m_probed >= m_cap;}
+    void next() {
+        m_probed += m_width;
+        m_index += m_step;
+        if (m_index >= m_cap) {
+            m_index -= m_cap;
+        }
+        m_step += m_growth;
+        if (m_step >= m_cap) {
+            m_step -= m_cap;
+        }
+    }
+private:
+    size_t m_index;     // current bucket
+    size_t m_step;      // distance to the next bucket, always below m_cap
+    size_t m_growth;    // change of the step after every move
+    size_t m_width;     // buckets covered by one move
+    size_t m_probed;    // buckets covered so far
+    size_t m_cap;       // capacity of the table
+};
+
+// index of the highest set bit of a non-zero size
+static inline int floorLog2(size_t value) {
+    int k = 0;
+    while (value >>= 1) {
+        k++;
+    }
+    return k;
+}
+
+// control bytes are written by the background migrator while lookups read them
+// a byte is published with release after its slot is complete, and a lookup
+// loads it with acquire before it reads the slot
+static inline unsigned char loadCtrl(const unsigned char* ctrl, size_t index) {
+#if defined(__GNUC__)
+    return __atomic_load_n(ctrl + index, __ATOMIC_ACQUIRE);
+#else
+    unsigned char value = *(const volatile unsigned char*)(ctrl + index);
+    atomic_thread_fence(memory_order_acquire);
+    return value;
+#endif
+}
+
+static inline void storeCtrl(unsigned char* ctrl, size_t index, unsigned char value) {
+#if defined(__GNUC__)
+    __atomic_store_n(ctrl + index, value, __ATOMIC_RELEASE);
+#else
+    atomic_thread_fence(memory_order_release);
+    *(volatile unsigned char*)(ctrl + index) = value;
+#endif
+}
+
+// slot fields and table fields that lookups read while a writer changes them
+// are accessed one by one with relaxed atomics, the sequence number of the
+// cache tells the lookup afterwards whether what it read belongs together
+template <class T>
+static inline T loadShared(const T& field) {
+    T value;
+    __atomic_load(&field, &value, __ATOMIC_RELAXED);
+    return value;
+}
+
+template <class T>
+static inline void storeShared(T& field, T value) {
+    __atomic_store(&field, &value, __ATOMIC_RELAXED);
+}
+
+// epoch based reclamation of retired tables
+// a lookup that runs alongside writers publishes the epoch it started in, and a
+// retired table is deallocated once every published epoch is newer than the one
+// the table was retired in, an epoch of 0 means the thread is not in a lookup
+const int MAXREADERS = 256;     // threads that get an epoch slot of their own
+const int MAXRETRY = 16;        // failed attempts of a lookup before it yields between attempts
+
+struct alignas(64) ReaderEpoch {
+    atomic<uint64_t> m_epoch;   // epoch of the running lookup, 0 if there is none
+    atomic<bool>     m_taken;   // the slot belongs to a thread
+};
+static ReaderEpoch g_readerEpochs[MAXREADERS];
+static atomic<uint64_t> g_epoch(1);
+static atomic<int> g_unslottedReaders(0);   // lookups of threads beyond MAXREADERS
+
+// the epoch slot of a thread, claimed by its first lookup and freed when it exits
+class EpochSlot {
+public:
+    EpochSlot() : m_index(-2) {}
+    ~EpochSlot() {
+        if (m_index >= 0) {
+            g_readerEpochs[m_index].m_taken.store(false);
+        }
+    }
+    // returns the slot of the thread, -1 if all of them are taken
+    int index() {
+        if (m_index == -2) {
+            m_index = -1;
+            for (int i = 0; i < MAXREADERS && m_index < 0; i++) {
+                bool expected = false;
+                if (g_readerEpochs[i].m_taken.compare_exchange_strong(expected, true)) {
+                    m_index = i;
+                }
+            }
+        }
+        return m_index;
+    }
+private:
+    int m_index;
+};
+static thread_local EpochSlot t_epochSlot;
+
+// marks the calling thread as reading tables as of the current epoch
+static inline int pinEpoch() {
+    int slot = t_epochSlot.index();
+    if (slot >= 0) {
+        g_readerEpochs[slot].m_epoch.store(g_epoch.load(), memory_order_relaxed);
+    } else {
+        g_unslottedReaders.fetch_add(1, memory_order_relaxed);
+    }
+    // the table pointers are loaded only after the epoch is visible to writers
+    atomic_thread_fence(memory_order_seq_cst);
+    return slot;
+}
+
+static inline void unpinEpoch(int slot) {
+    if (slot >= 0) {
+        g_readerEpochs[slot].m_epoch.store(0, memory_order_release);
+    } else {
+        g_unslottedReaders.fetch_sub(1, memory_order_release);
+    }
+}
+
+// the counter stripe of a thread, threads take the stripes in turn
+static atomic<unsigned int> g_nextStripe(0);
+static thread_local unsigned int t_metricStripe = g_nextStripe.fetch_add(1) % METRICSTRIPES;
+
+// adds amount to a counter of the stripe of the calling thread
+// a relaxed add on a line the other threads rarely touch, nothing when compiled out
+inline void Cache::countMetric(MetricStripe::counter_t counter, uint64_t amount) const {
+#ifndef CACHE_NO_METRICS
+    m_metrics[t_metricStripe].m_count[counter].fetch_add(amount, memory_order_relaxed);
+#else
+    (void)counter;
+    (void)amount;
+#endif
+}
+
+// writes an operation to the trace recorder, if there is one
+inline void Cache::traceOp(op_t op, string_view key, int id, int newID) const {
+    if (m_trace != nullptr) {
+        m_trace->record(op, key, id, newID);
+    }
+}
+
+// set when the calling thread starts a rehash or moves old buckets,
+// an operation timer clears it first and looks at it when the operation ends
+static thread_local bool t_migrationWork = false;
+
+// times one insert, remove, lookup or update into its latency histogram while
+// tracking is on, and into the OPMIGRATION histogram too if it did rehash work
+// the timer is made before the write lock is taken, so the wait for the lock counts
+class Cache::OpTimer{
+    public:
+#ifndef CACHE_NO_LATENCY
+    OpTimer(const Cache& cache, op_t op) : m_histograms(nullptr), m_op(op) {
+        if (cache.m_trackLatency) {
+            m_histograms = cache.m_latency;
+            t_migrationWork = false;
+            m_start = chrono::steady_clock::now();
+        }
+    }
+    ~OpTimer() {
+        if (m_histograms != nullptr) {
+            uint64_t nanos = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - m_start).count());
+            m_histograms[m_op].record(nanos);
+            if (t_migrationWork) {
+                m_histograms[OPMIGRATION].record(nanos);
+            }
+        }
+    }
+    private:
+    LatencyHistogram* m_histograms;         // histograms of the cache, nullptr when not timing
+    op_t m_op;                              // histogram of the operation
+    chrono::steady_clock::time_point m_start;
+#else
+    OpTimer(const Cache&, op_t) {}
+#endif
+};
+
+// parameterized constructors - take input and assign the parameter to the right data members
+// takes a hash function of the old signature, every call to it copies the key into a string
+Cache::Cache(size_t size, hash_fn hash, prob_t probing = DEFPOLCY, hash_t hashing)
+    : Cache(size, static_cast<hash_view_fn>(nullptr), probing, hashing){
     m_hash = hash;
+}
+
+// parameterized constructor with a hash function that reads the key in place
+Cache::Cache(size_t size, hash_view_fn hash, prob_t probing, hash_t hashing){
+    // stores hash function and probing policy
+    m_viewHash = hash;
+    m_hash = nullptr;
+    m_hashing = hashing;
     m_currProbing = probing;
     m_newPolicy = probing;  // same as current at the start
 
-    // find a prime >= requested size
-    // Handle edge cases for size bounds
-    if (size < MINPRIME) {
-        m_currentCap = MINPRIME;
-    } else if (size > MAXPRIME) {
-        m_currentCap = MAXPRIME;
-    } else if (isPrime(size)) {
-        m_currentCap = size;
-    } else {
-        m_currentCap = findNextPrime(size);
+    // find a prime >= requested size on the prime ladder, a negative int size
+    // wraps to a huge size_t and gets the smallest table, absurd sizes are capped
+    if (size > static_cast<size_t>(PTRDIFF_MAX)) {
+        size = MINPRIME;
+    } else if (size > MAXINITCAP) {
+        size = MAXINITCAP;
     }
+    int step = ladderIndexFor(size);
+    m_currentCap = PRIMELADDER[step].m_prime;
+    m_currentMod = PRIMELADDER[step].m_mod;
 
     // allocate the current table
-    m_currentTable = new Person*[m_currentCap];
-    for (int i = 0; i < m_currentCap; i++) {
-        m_currentTable[i] = nullptr;
-    }
+    m_currentTable = allocTable(m_currentCap);
+    m_currentCtrl = allocCtrl(m_currentCap);
+    m_currentKeys = new KeyPool();
 
     // initialize the counters
     m_currentSize = 0;
     m_currNumDeleted = 0;
+    m_currentKeyBytes = 0;
 
     // old table starts empty
     m_oldTable = nullptr;
+    m_oldCtrl = nullptr;
+    m_oldKeys = nullptr;
     m_oldCap = 0;
+    m_oldMod = 0;
     m_oldSize = 0;
     m_oldNumDeleted = 0;
     m_oldProbing = probing;
 
     // transfer index for incremental rehashing
     m_transferIndex = 0;
+    m_transferBudget = DEFTRANSFER;
+    m_transferStep = 0;
+    m_handoffKeys = false;
+
+    // no background migrator until it is started
+    m_background = false;
+    m_stopMigrator = false;
+
+    // lookups come from the writing thread until told otherwise
+    m_sharedReads = false;
+    m_seq = 0;
+    m_writeDepth = 0;
+    m_retired = nullptr;
+    resetMetrics();
+
+    // no histograms until latency tracking is turned on
+    m_trackLatency = false;
+    m_latency = nullptr;
+    m_trace = nullptr;
 }
 
-// destructor - deletes the Person objects in the array and the deallocate memory for the table
+// destructor - deallocates the slot arrays and the key pools of both tables
 Cache::~Cache(){
+    // the migrator must not touch the tables while they are deallocated
+    stopBackgroundRehash();
+
     // clean up the current table
     if(m_currentTable != nullptr) {
-        for (int i = 0; i < m_currentCap; i++) {    // traverses through the whole current table
-            if (m_currentTable[i] != nullptr) {     // checks if not null, then the following steps:
-                delete m_currentTable[i];           // delete Person object
-                m_currentTable[i] = nullptr;        // sets the index in the table to null
-            }
-        }
-        delete[] m_currentTable;                    // delete array of Person* pointers
+        delete[] m_currentTable;                    // delete array of slots
         m_currentTable = nullptr;                   // sets the table to null
+        delete[] m_currentCtrl;                     // delete the control bytes
+        m_currentCtrl = nullptr;
+        delete m_currentKeys;                       // releases all key bytes at once
+        m_currentKeys = nullptr;
     }
 
     // clean up the old table (if rehashing was in progress)
     if (m_oldTable != nullptr) {
-        for (int i = 0; i < m_oldCap; i++) {        // traverses through the whole old table
-            if (m_oldTable[i] != nullptr) {         // checks if not null, then the following steps:
-                delete m_oldTable[i];               // delete Person object
-                m_oldTable[i] = nullptr;            // sets the index in the table to null
-            }
-        }
-        delete[] m_oldTable;                        // delete array of Person* objects
+        delete[] m_oldTable;                        // delete array of slots
         m_oldTable = nullptr;                       // sets the table to null
+        delete[] m_oldCtrl;                         // delete the control bytes
+        m_oldCtrl = nullptr;
+        delete m_oldKeys;                           // releases all key bytes at once
+        m_oldKeys = nullptr;
     }   
+
+    // tables retired while lookups were running, no lookup may be left now
+    reclaimTables(true);
+
+    delete[] m_latency;
+    m_latency = nullptr;
+}
+
+// sets the number of old buckets every insert and remove moves to the current table
+// takes effect with the next rehash, zero is taken as one
+void Cache::setTransferBudget(size_t buckets){
+    m_transferBudget = (buckets == 0) ? 1 : buckets;
+}
+
+// returns the number of old buckets scanned per insert/remove in the running rehash,
+// zero when there is no rehash
+size_t Cache::transferStep() const{
+    return m_transferStep;
+}
+
+// moves up to the given number of old buckets to the current table outside of
+// insert and remove, zero moves all of them
+// returns true while the rehash is still in progress
+bool Cache::drainRehash(size_t buckets){
+    unique_lock<recursive_mutex> lock = writeLock();
+    beginWrite();
+    transferBuckets((buckets == 0) ? m_oldCap : buckets);
+    endWrite();
+    return m_oldTable != nullptr;
+}
+
+// returns true while records are still being moved out of the old table
+bool Cache::isRehashing() const{
+    return __atomic_load_n(&m_oldTable, __ATOMIC_ACQUIRE) != nullptr;
+}
+
+// with shared reads on, getPerson may run on any number of threads while
+// insert, remove and updateID run on others, the writers take turns on a lock
+// and the lookups take no lock, must not be switched while other threads use the cache
+void Cache::setSharedReads(bool shared){
+    m_sharedReads = shared;
+}
+
+// starts a thread that moves the old table into the current one as soon as a
+// rehash starts, so that a rehash finishes even when only lookups follow it
+// lookups run alongside the migrator without a lock, as with shared reads
+void Cache::startBackgroundRehash(){
+    if (m_background.load(memory_order_acquire)) {
+        return;     // already running
+    }
+    m_background.store(true, memory_order_release);
+    m_stopMigrator = false;
+    m_migrator = thread(&Cache::migrate, this);
+}
+
+// stops the migrator thread, a running rehash goes on with inserts and removes
+void Cache::stopBackgroundRehash(){
+    if (!m_background.load(memory_order_acquire)) {
+        return;
+    }
+    {
+        lock_guard<recursive_mutex> lock(m_writeLock);
+        m_stopMigrator = true;
+    }
+    m_rehashStarted.notify_all();
+    m_migrator.join();
+    m_background.store(false, memory_order_release);
 }
 
 // sets the parameter value to the data member value m_newPolicy
 void Cache::changeProbPolicy(prob_t policy){
+    unique_lock<recursive_mutex> lock = writeLock();
     // store the new policy request
     m_newPolicy = policy;
 }
 
 // inserts a Person object into the hash table
 // returns true if insertion succeeds, false otherwise
-bool Cache::insert(Person person){
+bool Cache::insert(const Person& person){
+    return emplace(person.m_key, person.m_id);
+}
+
+// inserts the record (key, id) without a Person object, the key bytes are copied
+// straight into the key pool of the table
+// returns true if insertion succeeds, false otherwise
+bool Cache::emplace(string_view key, int id){
+    return emplaceKeyed(key, id, keyHash(key));
+}
+
+// emplace with the hash of the key already computed, e.g. by ShardedCache to pick the shard
+bool Cache::emplaceKeyed(string_view key, int id, unsigned int keyHash){
+    traceOp(OPINSERT, key, id);
+    OpTimer timer(*this, OPINSERT);
+    unique_lock<recursive_mutex> lock = writeLock();
+
     // validate ID
-    // checks if the Person object id is within the allowed range
-    if (person.getID() < MINID || person.getID() > MAXID) {
+    // checks if the id is within the allowed range
+    if (id < MINID || id > MAXID) {
         return false;
     }
 
-    // check duplicates
-    if (getPerson(person.getKey(), person.getID()).getUsed()) {
+    return insertHashed(key, id, combineID(keyHash, id));
+}
+
+// inserts (key, id) with its bucket hash already computed, the caller holds the write lock
+bool Cache::insertHashed(string_view key, int id, unsigned int hash){
+    // check duplicates, the same probe of the current table finds the slot to use
+    size_t index;
+    size_t dist;
+    if (findInsertSlot(hash, key, id, index, dist)) {
         return false;
     }
+    // the old table only has to be searched while its records are being moved
+    if (m_oldTable != nullptr &&
+        findRecord(m_oldTable, m_oldCtrl, m_oldCap, m_oldMod, m_oldProbing, hash, key, id) != NOSLOT) {
+        return false;
+    }
+    if (index == NOSLOT) {
+        return false;   // table is full
+    }
 
-    // compute the initial index
-    // hash the key and map it into the current table
-    int index = m_hash(person.getKey()) % m_currentCap;
-    int i = 0;
-    int newIndex = index;
-
-    // collision resolution
-    while (true) {
-        // if slot is empty or marked unused, insert
-        if (m_currentTable[newIndex] == nullptr || !m_currentTable[newIndex]->getUsed()) {
-            // allocate a new Person object if slot is empty
-            if (m_currentTable[newIndex] == nullptr) {
-                m_currentTable[newIndex] = new Person();
-            }
-            // copy the Person data into the slot
-            *m_currentTable[newIndex] = person;
-            m_currentTable[newIndex]->setUsed(true);
-            m_currentSize++;
-            break;
-        }
-
-        // probe the next index
-        i++;
-        newIndex = probeIndex(index, i, m_currProbing, m_currentCap, m_hash, person.getKey());
-
-        // checks if the entire hash table has been probed
-        if (i >= m_currentCap) {
+    // copy the Person data into the current table
+    beginWrite();
+    if (m_currProbing == ROBINHOOD) {
+        if (!placeRobinHood(index, dist, key.data(), key.length(), hash, id)) {
+            endWrite();
             return false;   // table is full
         }
+    } else {
+        if (m_currentCtrl[index] == DELETED) {
+            countMetric(MetricStripe::TOMBSTONEREUSES);
+        }
+        placeRecord(index, key.data(), key.length(), hash, id);
     }
+    countMetric(MetricStripe::INSERTS);
 
     // check the rehash criteria
     // checks if the rehash is already in progress
-    // if loads exceed 0.5, start rehashing into a larger table
+    // if loads exceed the limit of the policy, start rehashing into a larger table
     if (m_oldTable == nullptr) {
         float load = lambda();
-        if (load > 0.5f) {
+        if (load > maxLoad(m_currProbing)) {
+            countMetric(MetricStripe::LOADREHASHES);
             startRehash();
         }
     }
     
     // moves portions of the elements from the old table into a new one
     incrementalTransfer();
+    endWrite();
 
     return true;    // successfully inserted to the table
 }
 
 // searches through the hash table to find the Person object in question to remove if it exist
 // returns true if successful, false otherwise
-bool Cache::remove(Person person){
+bool Cache::remove(const Person& person){
+    return remove(person.m_key, person.m_id);
+}
+
+// removes the record (key, id) without a Person object
+bool Cache::remove(string_view key, int id){
+    return removeKeyed(key, id, keyHash(key));
+}
+
+// remove with the hash of the key already computed
+bool Cache::removeKeyed(string_view key, int id, unsigned int keyHash){
+    traceOp(OPREMOVE, key, id);
+    OpTimer timer(*this, OPREMOVE);
+    unique_lock<recursive_mutex> lock = writeLock();
+
     // validate input
-    // checks if the Person object id is within the allowed range
-    if (person.getID() < MINID || person.getID() > MAXID) {
+    // checks if the id is within the allowed range
+    if (id < MINID || id > MAXID) {
         return false;
     }
 
+    // the bucket hash is the same for both tables
+    return removeHashed(key, id, combineID(keyHash, id));
+}
+
+// removes (key, id) with its bucket hash already computed, the caller holds the write lock
+bool Cache::removeHashed(string_view key, int id, unsigned int hash){
     // search in the current table
-    if (m_currentTable != nullptr) {
-        int index = m_hash(person.getKey()) % m_currentCap;
-        int i = 0;
-        int newIndex = index;
-
-        // probe through the table until either parameter Person is found or reached the end
-        while (i < m_currentCap) {
-            if (m_currentTable[newIndex] == nullptr) {
-                break; // not found
-            }
-            if (m_currentTable[newIndex]->getUsed() && 
-                m_currentTable[newIndex]->getKey() == person.getKey() &&
-                m_currentTable[newIndex]->getID() == person.getID()) {
-                
-                // lazy delete
-                // mark the slot as unused instead of freeing memory immediately
-                m_currentTable[newIndex]->setUsed(false);
-                m_currNumDeleted++;
-
-                // check thresholds for rehash
-                // checks if the rehash is already in progress
-                // if too many slots are lazily deleted, do rehash
-                if (m_oldTable == nullptr) {
-                    float delRatio = deletedRatio();
-                    if (delRatio > 0.8f) {
-                        startRehash();
-                    }
-                }
-                
-                incrementalTransfer();
+    size_t index = findRecord(m_currentTable, m_currentCtrl, m_currentCap, m_currentMod, m_currProbing,
+                           hash, key, id);
+    if (index != NOSLOT) {
+        beginWrite();
+        m_currentKeyBytes -= poolBytes(m_currentTable[index].keyLength());
+        if (m_currProbing == ROBINHOOD) {
+            // no deleted marker, the rest of the cluster shifts back
+            backwardShift(index);
+        } else {
+            // lazy delete
+            // mark the slot as deleted, the key bytes stay for reuse by the next insert
+            setCtrl(m_currentCtrl, m_currentCap, index, DELETED);
+            m_currNumDeleted++;
+        }
 
-                return true;    // successfully removed
+        // check thresholds for rehash
+        // checks if the rehash is already in progress
+        // if too many slots are lazily deleted, do rehash
+        if (m_oldTable == nullptr) {
+            float delRatio = deletedRatio();
+            if (delRatio > 0.8f) {
+                countMetric(MetricStripe::DELETEDREHASHES);
+                startRehash();
             }
-
-            // collision probing
-            i++;
-            newIndex = probeIndex(index, i, m_currProbing, m_currentCap, m_hash, person.getKey());
         }
+        
+        incrementalTransfer();
+        endWrite();
+        countMetric(MetricStripe::REMOVES);
+
+        return true;    // successfully removed
     }
 
     // search in old table if rehashing
     if (m_oldTable != nullptr) {
-        int index = m_hash(person.getKey()) % m_oldCap;
-        int i = 0;
-        int newIndex = index;
-
-        while (i < m_oldCap) {
-            if (m_oldTable[newIndex] == nullptr) {
-                break; // not found
-            }
-            if (m_oldTable[newIndex]->getUsed() &&
-                m_oldTable[newIndex]->getKey() == person.getKey() &&
-                m_oldTable[newIndex]->getID() == person.getID()) {
-                
-                // lazy delete
-                m_oldTable[newIndex]->setUsed(false);
-                m_oldNumDeleted++;
-
-                incrementalTransfer();
-
-                return true;    // successfully removed
-            }
-
-            // collision probing in the old table
-            i++;
-            newIndex = probeIndex(index, i, m_oldProbing, m_oldCap, m_hash,person.getKey());
+        index = findRecord(m_oldTable, m_oldCtrl, m_oldCap, m_oldMod, m_oldProbing,
+                           hash, key, id);
+        if (index != NOSLOT) {
+            // lazy delete, also for ROBINHOOD: shifting records back could move
+            // one behind m_transferIndex where the transfer would never see it
+            beginWrite();
+            setCtrl(m_oldCtrl, m_oldCap, index, DELETED);
+            m_oldNumDeleted++;
+
+            incrementalTransfer();
+            endWrite();
+            countMetric(MetricStripe::REMOVES);
+
+            return true;    // successfully removed
         }
     }
     
@@ -220,123 +679,343 @@ bool Cache::remove(Person person){
 }
 
 // searches for the Person object with the key and the ID in the hash table
-const Person Cache::getPerson(string key, int ID) const{
+const Person Cache::getPerson(string_view key, int ID) const{
+    return getPersonKeyed(key, ID, keyHash(key));
+}
+
+// getPerson with the hash of the key already computed
+Person Cache::getPersonKeyed(string_view key, int ID, unsigned int keyHash) const{
+    traceOp(OPLOOKUP, key, ID);
+    OpTimer timer(*this, OPLOOKUP);
     // validate input
     // checks if the Person object id is within the allowed range
     if (ID < MINID || ID > MAXID) {
         return Person();
     }
 
-    // search the current table
-    if (m_currentTable != nullptr) {
-        int index = m_hash(key) % m_currentCap;
-        int i = 0;
-        int newIndex = index;
+    // the bucket hash is the same for both tables
+    return lookup(combineID(keyHash, ID), key, ID);
+}
 
-        // probe through the table until either parameter Person is found or reached the end
-        while (i < m_currentCap) {
-            if (m_currentTable[newIndex] == nullptr) {
-                break;  // not found
+// looks (key, ID) up with its bucket hash already computed
+Person Cache::lookup(unsigned int hash, string_view key, int ID) const{
+    // lookups that run alongside writers do not take the lock
+    // the slot may be reused by the time they return, the record is rebuilt
+    // from the key and the ID it was compared with
+    const Slot* slot = nullptr;
+    bool found;
+    if (m_sharedReads || m_background.load(memory_order_acquire)) {
+        found = concurrentFind(hash, key, ID);
+    } else {
+        slot = findSlot(hash, key, ID);
+        found = (slot != nullptr);
+    }
+    countMetric(MetricStripe::LOOKUPS);
+    countMetric(found ? MetricStripe::HITS : MetricStripe::MISSES);
+    // the Person is built in the return statement, Person has no copy constructor
+    // of its own and the implicit one is deprecated
+    if (slot != nullptr) {
+        return slot->toPerson();
+    }
+    return found ? Person(string(key), ID, true) : Person();
+}
+
+// looks (key, ID) up without building a Person or a string
+// the view refers to the stored key bytes when no writer can run alongside,
+// and to the bytes of the key passed in otherwise, so it has to be used before the
+// next insert, remove or updateID, and while the key passed in still exists
+PersonView Cache::getPersonView(string_view key, int ID) const{
+    return getPersonViewKeyed(key, ID, keyHash(key));
+}
+
+// getPersonView with the hash of the key already computed
+PersonView Cache::getPersonViewKeyed(string_view key, int ID, unsigned int keyHash) const{
+    traceOp(OPLOOKUP, key, ID);
+    OpTimer timer(*this, OPLOOKUP);
+    // validate input
+    if (ID < MINID || ID > MAXID) {
+        return PersonView();
+    }
+
+    unsigned int hash = combineID(keyHash, ID);
+    PersonView view;
+    if (m_sharedReads || m_background.load(memory_order_acquire)) {
+        if (concurrentFind(hash, key, ID)) {
+            view = PersonView(key.data(), key.length(), ID);
+        }
+    } else {
+        const Slot* slot = findSlot(hash, key, ID);
+        if (slot != nullptr) {
+            view = PersonView(slot->keyData(), slot->keyLength(), slot->getID());
+        }
+    }
+    countMetric(MetricStripe::LOOKUPS);
+    countMetric(view.getUsed() ? MetricStripe::HITS : MetricStripe::MISSES);
+    return view;
+}
+
+// looks up count records at once, results[i] is what getPerson(people[i]) would return
+// the keys are hashed and the home buckets of a whole block are prefetched first,
+// so the cache misses of the block overlap instead of following each other
+void Cache::getPersonBatch(const Person people[], int count, Person results[]) const{
+    unsigned int hashes[BATCHBLOCK];
+    for (int first = 0; first < count; first += BATCHBLOCK) {
+        int last = (count - first < BATCHBLOCK) ? count : first + BATCHBLOCK;
+        for (int i = first; i < last; i++) {
+            hashes[i - first] = bucketHash(people[i].m_key, people[i].m_id);
+            prefetchHome(hashes[i - first]);
+        }
+        for (int i = first; i < last; i++) {
+            traceOp(OPLOOKUP, people[i].m_key, people[i].m_id);
+            if (people[i].m_id < MINID || people[i].m_id > MAXID) {
+                results[i] = Person();
+            } else {
+                results[i] = lookup(hashes[i - first], people[i].m_key, people[i].m_id);
+            }
+        }
+    }
+}
+
+// inserts count records at once, results[i] (if given) is what insert(people[i]) would return
+// returns the number of records inserted
+// the write lock is taken once per block, the home buckets are prefetched as for getPersonBatch
+int Cache::insertBatch(const Person people[], int count, bool results[]){
+    unsigned int hashes[BATCHBLOCK];
+    int inserted = 0;
+    for (int first = 0; first < count; first += BATCHBLOCK) {
+        int last = (count - first < BATCHBLOCK) ? count : first + BATCHBLOCK;
+        unique_lock<recursive_mutex> lock = writeLock();
+        for (int i = first; i < last; i++) {
+            hashes[i - first] = bucketHash(people[i].m_key, people[i].m_id);
+            prefetchHome(hashes[i - first]);
+        }
+        for (int i = first; i < last; i++) {
+            traceOp(OPINSERT, people[i].m_key, people[i].m_id);
+            bool done = (people[i].m_id >= MINID && people[i].m_id <= MAXID) &&
+                        insertHashed(people[i].m_key, people[i].m_id, hashes[i - first]);
+            if (done) {
+                inserted++;
             }
-            if (m_currentTable[newIndex]->getUsed() && 
-                m_currentTable[newIndex]->getKey() == key &&
-                m_currentTable[newIndex]->getID() == ID) {
-                return *m_currentTable[newIndex];   // found
+            if (results != nullptr) {
+                results[i] = done;
             }
+        }
+    }
+    return inserted;
+}
 
-            // collision probing
-            i++;
-            newIndex = probeIndex(index, i, m_currProbing, m_currentCap, m_hash, key);
+// removes count records at once, results[i] (if given) is what remove(people[i]) would return
+// returns the number of records removed
+int Cache::removeBatch(const Person people[], int count, bool results[]){
+    unsigned int hashes[BATCHBLOCK];
+    int removed = 0;
+    for (int first = 0; first < count; first += BATCHBLOCK) {
+        int last = (count - first < BATCHBLOCK) ? count : first + BATCHBLOCK;
+        unique_lock<recursive_mutex> lock = writeLock();
+        for (int i = first; i < last; i++) {
+            hashes[i - first] = bucketHash(people[i].m_key, people[i].m_id);
+            prefetchHome(hashes[i - first]);
+        }
+        for (int i = first; i < last; i++) {
+            traceOp(OPREMOVE, people[i].m_key, people[i].m_id);
+            bool done = (people[i].m_id >= MINID && people[i].m_id <= MAXID) &&
+                        removeHashed(people[i].m_key, people[i].m_id, hashes[i - first]);
+            if (done) {
+                removed++;
+            }
+            if (results != nullptr) {
+                results[i] = done;
+            }
         }
     }
+    return removed;
+}
+
+// returns the slot holding (key, ID) in either table, nullptr if there is none
+const Slot* Cache::findSlot(unsigned int hash, string_view key, int ID) const{
+    // search the current table
+    size_t index = findRecord(m_currentTable, m_currentCtrl, m_currentCap, m_currentMod, m_currProbing,
+                              hash, key, ID);
+    if (index != NOSLOT) {
+        return &m_currentTable[index];   // found
+    }
 
     // search old table if rehashing
     if (m_oldTable != nullptr) {
-        int index = m_hash(key) % m_oldCap;
-        int i = 0;
-        int newIndex = index;
+        index = findRecord(m_oldTable, m_oldCtrl, m_oldCap, m_oldMod, m_oldProbing, hash, key, ID);
+        if (index != NOSLOT) {
+            return &m_oldTable[index];   // found
+        }
+    }
 
-        while (i < m_oldCap) {
-            if (m_oldTable[newIndex] == nullptr) {
-                break; // not found
-            }
-            if (m_oldTable[newIndex]->getUsed() &&
-                m_oldTable[newIndex]->getKey() == key &&
-                m_oldTable[newIndex]->getID() == ID) {
-                return *m_oldTable[newIndex];   // found
+    // Not found
+    return nullptr;
+}
+
+// lookup that runs alongside writers and the background migrator without a lock
+// the lookup is repeated when a writer changed the tables while it ran, tables it
+// may still be reading are not deallocated until it is done (see retireTable)
+// it never takes the writer lock: after MAXRETRY failed attempts it gives the
+// processor up between attempts, so writers that keep changing the tables
+// slow it down but do not make it wait for them
+// the migrator copies a record into the current table before it marks the old
+// slot deleted, so the old table is searched first: a record that is gone from
+// there is already visible in the current table
+bool Cache::concurrentFind(unsigned int hash, string_view key, int ID) const{
+    int slot = pinEpoch();
+    bool found = false;
+    bool done = false;
+    for (int attempt = 0; !done; attempt++) {
+        if (attempt >= MAXRETRY) {
+            if (attempt == MAXRETRY) {
+                countMetric(MetricStripe::BACKOFFLOOKUPS);
             }
+            this_thread::yield();
+        }
+        uint64_t seq = m_seq.load(memory_order_acquire);
+        if (seq & 1) {
+            this_thread::yield();   // a writer is in the middle of a change
+            continue;
+        }
 
-            // collision probing
-            i++;
-            newIndex = probeIndex(index, i, m_oldProbing, m_oldCap, m_hash, key);
+        // the table fields are only used once they are known to belong together
+        const Slot* oldTable = loadShared(m_oldTable);
+        const unsigned char* oldCtrl = loadShared(m_oldCtrl);
+        size_t oldCap = loadShared(m_oldCap);
+        uint64_t oldMod = loadShared(m_oldMod);
+        prob_t oldProbing = loadShared(m_oldProbing);
+        const Slot* table = loadShared(m_currentTable);
+        const unsigned char* ctrl = loadShared(m_currentCtrl);
+        size_t cap = loadShared(m_currentCap);
+        uint64_t mod = loadShared(m_currentMod);
+        prob_t probing = loadShared(m_currProbing);
+        if (!seqUnchanged(seq)) {
+            continue;
+        }
 
+        found = false;
+        if (oldTable != nullptr) {
+            found = findRecord(oldTable, oldCtrl, oldCap, oldMod, oldProbing, hash, key, ID, seq) != NOSLOT;
+        }
+        if (!found) {
+            found = findRecord(table, ctrl, cap, mod, probing, hash, key, ID, seq) != NOSLOT;
+        }
+        done = seqUnchanged(seq);
+        if (!done) {
+            countMetric(MetricStripe::LOOKUPRETRIES);
         }
     }
 
-    // Not found
-    return Person();    // empty object
+    unpinEpoch(slot);
+    return found;
 }
 
 // searches for the Person object in the hash table and updates the ID if found
-bool Cache::updateID(Person person, int ID){
+bool Cache::updateID(const Person& person, int ID){
+    return updateIDKeyed(person, ID, keyHash(person.m_key));
+}
+
+// updateID with the hash of the key already computed, the key is hashed once
+// even when the record moves to the bucket of its new ID
+bool Cache::updateIDKeyed(const Person& person, int ID, unsigned int keyHash){
+    traceOp(OPUPDATE, person.m_key, person.m_id, ID);
+    OpTimer timer(*this, OPUPDATE);
+    unique_lock<recursive_mutex> lock = writeLock();
+
     // validate the new ID
     if (ID < MINID || ID > MAXID) {
         return false;
     }
 
-    // search current table
-    if (m_currentTable != nullptr) {
-        int index = m_hash(person.getKey()) % m_currentCap;
-        int i = 0;
-        int newIndex = index;
+    // with composite hashing the ID is part of the bucket hash,
+    // so the record has to move to the home bucket of its new ID
+    const string& key = person.m_key;
+    if (m_hashing == COMPOSITEHASH) {
+        unsigned int newHash = combineID(keyHash, ID);
+        if (ID == person.m_id) {
+            return findSlot(newHash, key, ID) != nullptr;
+        }
+        // do not create a second record with the same (key, ID) pair
+        unsigned int oldHash = combineID(keyHash, person.m_id);
+        if (findSlot(newHash, key, ID) != nullptr || findSlot(oldHash, key, person.m_id) == nullptr) {
+            return false;
+        }
+        // the new record goes in before the old one goes, both in one write section:
+        // a failed insert leaves the record as it was, and a lookup alongside
+        // never sees the record under neither ID
+        // the move also counts as a remove and an insert
+        beginWrite();
+        bool moved = insertHashed(key, ID, newHash);
+        if (moved) {
+            removeHashed(key, person.m_id, oldHash);
+            countMetric(MetricStripe::UPDATES);
+        }
+        endWrite();
+        return moved;
+    }
 
-        while (i < m_currentCap) {
-            if (m_currentTable[newIndex] == nullptr) {
-                break;  // not found in this chain
-            }
-            if (m_currentTable[newIndex]->getUsed() &&
-                m_currentTable[newIndex]->getKey() == person.getKey() &&
-                m_currentTable[newIndex]->getID() == person.getID()) {
-                // found and update ID
-                m_currentTable[newIndex]->setID(ID);
-                return true;
-            }
-            // collision probing
-            i++;
-            newIndex = probeIndex(index, i, m_currProbing, m_currentCap, m_hash, person.getKey());
+    // the bucket hash is the same for both tables
+    unsigned int hash = combineID(keyHash, person.m_id);
 
-        }
+    // search current table
+    size_t index = findRecord(m_currentTable, m_currentCtrl, m_currentCap, m_currentMod, m_currProbing,
+                           hash, key, person.m_id);
+    if (index != NOSLOT) {
+        // found and update ID
+        beginWrite();
+        setSlotID(m_currentTable[index], ID);
+        endWrite();
+        countMetric(MetricStripe::UPDATES);
+        return true;
     }
 
     // search old table if rehashing
     if (m_oldTable != nullptr) {
-        int index = m_hash(person.getKey()) % m_oldCap;
-        int i = 0;
-        int newIndex = index;
-
-        while (i < m_oldCap) {
-            if (m_oldTable[newIndex] == nullptr) {
-                break;  // not found
-            }
-            if (m_oldTable[newIndex]->getUsed() &&
-                m_oldTable[newIndex]->getKey() == person.getKey() &&
-                m_oldTable[newIndex]->getID() == person.getID()) {
-                // found and update ID
-                m_oldTable[newIndex]->setID(ID);
-                return true;
-            }
-
-            // collision probing
-            i++;
-            newIndex = probeIndex(index, i, m_oldProbing, m_oldCap, m_hash, person.getKey());
-
-        } 
+        index = findRecord(m_oldTable, m_oldCtrl, m_oldCap, m_oldMod, m_oldProbing,
+                           hash, key, person.m_id);
+        if (index != NOSLOT) {
+            // found and update ID
+            beginWrite();
+            setSlotID(m_oldTable[index], ID);
+            endWrite();
+            countMetric(MetricStripe::UPDATES);
+            return true;
+        }
     }
 
     // not found
     return false;
 }
 
+// updateID of a COMPOSITEHASH record whose new (key, ID) pair belongs to another
+// cache, for the shards of a ShardedCache, which takes both write locks in shard order
+// the record goes into dest before it leaves this cache, so a lookup alongside finds
+// it under one of the IDs (for a moment under both), never under neither
+bool Cache::moveRecord(Cache& dest, const Person& person, int ID, unsigned int keyHash){
+    traceOp(OPUPDATE, person.m_key, person.m_id, ID);
+    OpTimer timer(*this, OPUPDATE);
+    unique_lock<recursive_mutex> lock = writeLock();
+    unique_lock<recursive_mutex> destLock = dest.writeLock();
+
+    // validate the new ID
+    if (ID < MINID || ID > MAXID) {
+        return false;
+    }
+    const string& key = person.m_key;
+    unsigned int oldHash = combineID(keyHash, person.m_id);
+    unsigned int newHash = dest.combineID(keyHash, ID);
+    if (dest.findSlot(newHash, key, ID) != nullptr || findSlot(oldHash, key, person.m_id) == nullptr) {
+        return false;
+    }
+    // a failed insert leaves the record where it was
+    if (!dest.insertHashed(key, ID, newHash)) {
+        return false;
+    }
+    removeHashed(key, person.m_id, oldHash);
+    countMetric(MetricStripe::UPDATES);
+    return true;
+}
+
 // returns load factor of the current hash table
 // ratio of occupied buckets to the table capacity
 float Cache::lambda() const {
@@ -357,194 +1036,1342 @@ float Cache::deletedRatio() const {
 // dumps the contents of the current and old hash table
 // used for debugging
 void Cache::dump() const {
+    unique_lock<recursive_mutex> lock = writeLock();
     cout << "Dump for the current table: " << endl;
     if (m_currentTable != nullptr)
-        for (int i = 0; i < m_currentCap; i++) {
-            cout << "[" << i << "] : " << m_currentTable[i] << endl;
+        for (size_t i = 0; i < m_currentCap; i++) {
+            cout << "[" << i << "] : ";
+            if (m_currentCtrl[i] != EMPTY)
+                cout << m_currentTable[i].getKey() << " (" << m_currentTable[i].getID() << ", "
+                     << isLive(m_currentCtrl[i]) << ")";
+            cout << endl;
         }
     cout << "Dump for the old table: " << endl;
     if (m_oldTable != nullptr)
-        for (int i = 0; i < m_oldCap; i++) {
-            cout << "[" << i << "] : " << m_oldTable[i] << endl;
+        for (size_t i = 0; i < m_oldCap; i++) {
+            cout << "[" << i << "] : ";
+            if (m_oldCtrl[i] != EMPTY)
+                cout << m_oldTable[i].getKey() << " (" << m_oldTable[i].getID() << ", "
+                     << isLive(m_oldCtrl[i]) << ")";
+            cout << endl;
         }
 }
 
-// returns true if the parameter variable is a prime number
-bool Cache::isPrime(int number){
-    bool result = true;
-    for (int i = 2; i <= number / 2; ++i) {
-        if (number % i == 0) {
-            result = false;
-            break;
+// returns the sum of the counters over the stripes
+// the counters are read one by one while other threads may add to them
+CacheMetrics Cache::metrics() const {
+    uint64_t total[MetricStripe::NUMCOUNTERS] = {0};
+#ifndef CACHE_NO_METRICS
+    for (int i = 0; i < METRICSTRIPES; i++) {
+        for (int c = 0; c < MetricStripe::NUMCOUNTERS; c++) {
+            total[c] += m_metrics[i].m_count[c].load(memory_order_relaxed);
         }
     }
-    return result;
+#endif
+    CacheMetrics metrics;
+#ifndef CACHE_NO_METRICS
+    metrics.m_enabled = true;
+#else
+    metrics.m_enabled = false;
+#endif
+    metrics.m_lookups = total[MetricStripe::LOOKUPS];
+    metrics.m_hits = total[MetricStripe::HITS];
+    metrics.m_misses = total[MetricStripe::MISSES];
+    metrics.m_inserts = total[MetricStripe::INSERTS];
+    metrics.m_removes = total[MetricStripe::REMOVES];
+    metrics.m_updates = total[MetricStripe::UPDATES];
+    metrics.m_searches = total[MetricStripe::SEARCHES];
+    metrics.m_probes = total[MetricStripe::PROBES];
+    metrics.m_tombstoneReuses = total[MetricStripe::TOMBSTONEREUSES];
+    metrics.m_loadRehashes = total[MetricStripe::LOADREHASHES];
+    metrics.m_deletedRehashes = total[MetricStripe::DELETEDREHASHES];
+    metrics.m_migrated = total[MetricStripe::MIGRATED];
+    metrics.m_migrateNanos = total[MetricStripe::MIGRATENANOS];
+    metrics.m_lookupRetries = total[MetricStripe::LOOKUPRETRIES];
+    metrics.m_backoffLookups = total[MetricStripe::BACKOFFLOOKUPS];
+    return metrics;
 }
 
-// returns the smallest prime number greater than the parameter variable
-int Cache::findNextPrime(int current){
-    //we always stay within the range [MINPRIME-MAXPRIME]
-    //the smallest prime starts at MINPRIME
-    if (current < MINPRIME) current = MINPRIME-1;
-    for (int i=current; i<MAXPRIME; i++) { 
-        for (int j=2; j*j<=i; j++) {
-            if (i % j == 0) 
-                break;
-            else if (j+1 > sqrt(i) && i != current) {
-                return i;
-            }
+// sets every counter back to 0
+void Cache::resetMetrics() {
+#ifndef CACHE_NO_METRICS
+    for (int i = 0; i < METRICSTRIPES; i++) {
+        for (int c = 0; c < MetricStripe::NUMCOUNTERS; c++) {
+            m_metrics[i].m_count[c].store(0, memory_order_relaxed);
         }
     }
-    //if a user tries to go over MAXPRIME
-    return MAXPRIME;
+#endif
 }
 
+// adds up the bytes of both tables
+// a slot array has a slot per bucket, a control byte array has GROUPWIDTH-1 mirror bytes more
+CacheMemory Cache::memoryUsage() const {
+    unique_lock<recursive_mutex> lock = writeLock();
+    CacheMemory memory;
+    memory.m_records = (m_currentSize - m_currNumDeleted) + (m_oldSize - m_oldNumDeleted);
+    memory.m_slotBytes = 0;
+    memory.m_ctrlBytes = 0;
+    memory.m_keyBytes = 0;
+    memory.m_keyUsed = 0;
+    if (m_currentTable != nullptr) {
+        memory.m_slotBytes += m_currentCap * sizeof(Slot);
+        memory.m_ctrlBytes += m_currentCap + GROUPWIDTH - 1;
+        memory.m_keyBytes += m_currentKeys->bytes();
+        memory.m_keyUsed += m_currentKeys->used();
+    }
+    if (m_oldTable != nullptr) {
+        memory.m_slotBytes += m_oldCap * sizeof(Slot);
+        memory.m_ctrlBytes += m_oldCap + GROUPWIDTH - 1;
+        memory.m_keyBytes += m_oldKeys->bytes();
+        memory.m_keyUsed += m_oldKeys->used();
+    }
+    memory.m_totalBytes = memory.m_slotBytes + memory.m_ctrlBytes + memory.m_keyBytes;
+    memory.m_bytesPerRecord = (memory.m_records == 0) ? 0.0
+                              : static_cast<double>(memory.m_totalBytes) / memory.m_records;
+    return memory;
+}
 
-/*************************************
-********** Private Functions**********
-*************************************/
-
-// incrementally transfer elements from the old has table to the current hash table
-// designed to spread out the cost of rehashing
-void Cache::incrementalTransfer() {
-    // there is no old hash table to transfer ove
-    if (m_oldTable == nullptr) {
-        return;
+// turns the latency histograms on or off, they are allocated the first time
+// and keep their times while tracking is off
+// single inserts, removes, updateIDs and lookups are timed, batches are not,
+// the records of a batch are worked on together
+// must not be switched while other threads use the cache
+void Cache::setLatencyTracking(bool on) {
+#ifndef CACHE_NO_LATENCY
+    if (on && m_latency == nullptr) {
+        m_latency = new LatencyHistogram[NUMOPS];
     }
+    m_trackLatency = on;
+#else
+    (void)on;
+#endif
+}
 
-    // calculate the chunk size to transfer over in 1/4 portion of the old table
-    int chunk = m_oldCap / 4;   // floor division
-    if (chunk == 0) {
-        chunk = 1;
+// returns the percentiles of the times of an operation, all zero if nothing was recorded
+LatencySummary Cache::latency(op_t op) const {
+    if (m_latency == nullptr) {
+        return LatencyHistogram().summary();
     }
+    return m_latency[op].summary();
+}
 
-    // the range of the transfer
-    int start = m_transferIndex;
-    int end;
+// writes the percentiles of every operation
+void Cache::writeLatency(ostream& out, stats_t format) const {
+    LatencySummary summaries[NUMOPS];
+    for (int op = 0; op < NUMOPS; op++) {
+        summaries[op] = latency(static_cast<op_t>(op));
+    }
+    writeLatency(out, summaries, format);
+}
 
-    // if the 4th transfer, move all the remaining elements
-    int transfersDone = (chunk > 0) ? (m_transferIndex / chunk) : 0;
-    if (transfersDone >= 3) {
-        end = m_oldCap;
-    } else {
-        end = start + chunk;
-        if (end > m_oldCap) {
-            end = m_oldCap;
+// writes the summaries as a JSON object with one object per operation,
+// or as CSV rows of operation,metric,value, the times are in nanoseconds
+void Cache::writeLatency(ostream& out, const LatencySummary summaries[NUMOPS], stats_t format) {
+    static const char* const OPNAMES[] = {"insert", "remove", "lookup", "update", "migration"};
+    if (format == STATSCSV) {
+        out << "operation,metric,value" << endl;
+        for (int op = 0; op < NUMOPS; op++) {
+            const LatencySummary& s = summaries[op];
+            out << OPNAMES[op] << ",count," << s.m_count << endl;
+            out << OPNAMES[op] << ",mean," << s.m_mean << endl;
+            out << OPNAMES[op] << ",p50," << s.m_p50 << endl;
+            out << OPNAMES[op] << ",p90," << s.m_p90 << endl;
+            out << OPNAMES[op] << ",p99," << s.m_p99 << endl;
+            out << OPNAMES[op] << ",p999," << s.m_p999 << endl;
+            out << OPNAMES[op] << ",max," << s.m_max << endl;
         }
+        return;
     }
 
-    // transfer elements from the old table from the transfer range
-    for (int j = start; j < end; j++) {
-        if (m_oldTable[j] != nullptr && m_oldTable[j]->getUsed()) {
-            // copy the person object from the old table slot
-            Person person = *m_oldTable[j];
-
-            // compute the hash index in the new table
-            int index = m_hash(person.getKey()) % m_currentCap;
-            int i = 0;
-            int newIndex = index;
-
-            // probe until an empty or ununsed slot is found
-            while (true) {
-                if (m_currentTable[newIndex] == nullptr || !m_currentTable[newIndex]->getUsed()) {
-                    // allocate a new Person object if the slot is empty
-                    if (m_currentTable[newIndex] == nullptr) {
-                        m_currentTable[newIndex] = new Person();
-                    }
-                    // copy data into the slot and mark as used
-                    *m_currentTable[newIndex] = person;
-                    m_currentTable[newIndex]->setUsed(true);
-                    m_currentSize++;
-                    break;
-                }
-
-                // collision probing
-                i++;
-                newIndex = probeIndex(index, i, m_currProbing, m_currentCap, m_hash, person.getKey());
+    out << "{";
+    for (int op = 0; op < NUMOPS; op++) {
+        const LatencySummary& s = summaries[op];
+        out << (op > 0 ? ", " : "") << "\"" << OPNAMES[op] << "\": "
+            << "{\"count\": " << s.m_count
+            << ", \"mean\": " << s.m_mean
+            << ", \"p50\": " << s.m_p50
+            << ", \"p90\": " << s.m_p90
+            << ", \"p99\": " << s.m_p99
+            << ", \"p999\": " << s.m_p999
+            << ", \"max\": " << s.m_max << "}";
+    }
+    out << "}" << endl;
+}
 
-                // checks if the entire table has been probed
-                if (i >= m_currentCap) {
-                    break;
-                }
-            }
-            
-            // deallocate the old table and clear the slot
-            delete m_oldTable[j];
-            m_oldTable[j] = nullptr;
+// clears every histogram, may run while operations are timed
+void Cache::resetLatency() {
+    if (m_latency != nullptr) {
+        for (int op = 0; op < NUMOPS; op++) {
+            m_latency[op].reset();
         }
     }
+}
 
-    // update the transfer progress
-    m_transferIndex = end;
+// attaches a trace recorder, every insert, remove, lookup and updateID is written to it,
+// batches one record at a time, before the operation runs and whether it succeeds or not
+// the recorder has to outlive the cache or be detached with nullptr first
+// must not be switched while other threads use the cache
+void Cache::setTraceRecorder(TraceRecorder* recorder) {
+    m_trace = recorder;
+}
 
-    // if transfer is complete, clean up the old table
-        if (m_transferIndex >= m_oldCap) {
-        for (int i = 0; i < m_oldCap; i++) {
-            if (m_oldTable[i] != nullptr) {
-                delete m_oldTable[i];
-                m_oldTable[i] = nullptr;
-            }
-        }
-        delete[] m_oldTable;
-        m_oldTable = nullptr;
-        m_oldCap = 0;
+// looks at every bucket of both tables once and returns the probe lengths, the clusters
+// and the deleted markers found, nothing is printed
+CacheStats Cache::analyze() const {
+    unique_lock<recursive_mutex> lock = writeLock();
+    CacheStats stats;
+    analyzeTable(m_currentTable, m_currentCtrl, m_currentCap, m_currentMod, m_currProbing, stats.m_current);
+    analyzeTable(m_oldTable, m_oldCtrl, m_oldCap, m_oldMod, m_oldProbing, stats.m_old);
+    size_t live = stats.m_current.m_live + stats.m_old.m_live;
+    stats.m_oldFraction = (live == 0) ? 0.0 : static_cast<double>(stats.m_old.m_live) / live;
+    return stats;
+}
+
+// analyzes the tables and writes the result
+void Cache::writeStats(ostream& out, stats_t format) const {
+    writeStats(out, analyze(), format);
+}
+
+// writes the stats as a JSON object, or as CSV rows of table,metric,bucket,value
+// where bucket is the probe length, the cluster size class or the region of a
+// histogram row and empty otherwise
+void Cache::writeStats(ostream& out, const CacheStats& stats, stats_t format) {
+    static const char* const POLICYNAMES[] = {"QUADRATIC", "DOUBLEHASH", "LINEAR", "SWISS", "ROBINHOOD"};
+    const TableStats* tables[] = {&stats.m_current, &stats.m_old};
+    const char* names[] = {"current", "old"};
+
+    if (format == STATSCSV) {
+        out << "table,metric,bucket,value" << endl;
+        out << "cache,old_fraction,," << stats.m_oldFraction << endl;
+        for (int t = 0; t < 2; t++) {
+            const TableStats& table = *tables[t];
+            if (table.m_capacity == 0) {
+                continue;
+            }
+            out << names[t] << ",probing,," << POLICYNAMES[table.m_probing] << endl;
+            out << names[t] << ",capacity,," << table.m_capacity << endl;
+            out << names[t] << ",live,," << table.m_live << endl;
+            out << names[t] << ",deleted,," << table.m_deleted << endl;
+            out << names[t] << ",average_probe,," << table.m_averageProbe << endl;
+            out << names[t] << ",max_probe,," << table.m_maxProbe << endl;
+            out << names[t] << ",max_displacement,," << table.m_maxDisplacement << endl;
+            out << names[t] << ",clusters,," << table.m_clusters << endl;
+            out << names[t] << ",max_cluster,," << table.m_maxCluster << endl;
+            for (int k = 0; k < PROBEBUCKETS; k++) {
+                if (table.m_probeHistogram[k] != 0) {
+                    out << names[t] << ",probe_length," << k + 1 << "," << table.m_probeHistogram[k] << endl;
+                }
+            }
+            for (int k = 0; k < CLUSTERBUCKETS; k++) {
+                if (table.m_clusterHistogram[k] != 0) {
+                    out << names[t] << ",cluster_size," << (static_cast<size_t>(1) << k) << ","
+                        << table.m_clusterHistogram[k] << endl;
+                }
+            }
+            for (int k = 0; k < DENSITYREGIONS; k++) {
+                out << names[t] << ",region_deleted," << k << "," << table.m_regionDeleted[k] << endl;
+            }
+        }
+        return;
+    }
+
+    // the histograms are written in full, index k of probe_histogram is length k+1
+    // and index k of cluster_histogram counts sizes 2^k to 2^(k+1)-1
+    out << "{\"old_fraction\": " << stats.m_oldFraction;
+    for (int t = 0; t < 2; t++) {
+        const TableStats& table = *tables[t];
+        out << ", \"" << names[t] << "\": ";
+        if (table.m_capacity == 0) {
+            out << "null";
+            continue;
+        }
+        out << "{\"probing\": \"" << POLICYNAMES[table.m_probing] << "\""
+            << ", \"capacity\": " << table.m_capacity
+            << ", \"live\": " << table.m_live
+            << ", \"deleted\": " << table.m_deleted
+            << ", \"average_probe\": " << table.m_averageProbe
+            << ", \"max_probe\": " << table.m_maxProbe
+            << ", \"max_displacement\": " << table.m_maxDisplacement
+            << ", \"clusters\": " << table.m_clusters
+            << ", \"max_cluster\": " << table.m_maxCluster;
+        out << ", \"probe_histogram\": [";
+        for (int k = 0; k < PROBEBUCKETS; k++) {
+            out << (k > 0 ? ", " : "") << table.m_probeHistogram[k];
+        }
+        out << "], \"cluster_histogram\": [";
+        for (int k = 0; k < CLUSTERBUCKETS; k++) {
+            out << (k > 0 ? ", " : "") << table.m_clusterHistogram[k];
+        }
+        out << "], \"region_deleted\": [";
+        for (int k = 0; k < DENSITYREGIONS; k++) {
+            out << (k > 0 ? ", " : "") << table.m_regionDeleted[k];
+        }
+        out << "]}";
+    }
+    out << "}" << endl;
+}
+
+// returns the PRIMELADDER index of the smallest prime that is >= size, the
+// caller reads the capacity and its fastmod multiplier from that step
+// sizes beyond the last prime get the last step, the hash only has 32 bits
+int Cache::ladderIndexFor(size_t size){
+    int step = 0;
+    while (step < NUMPRIMES - 1 && PRIMELADDER[step].m_prime < size) {
+        step++;
+    }
+    return step;
+}
+
+
+/*************************************
+************* KeyPool ****************
+*************************************/
+
+// the first chunk is small so that small tables stay small
+const unsigned int KEYCHUNKMIN = 1024;
+const unsigned int KEYCHUNKMAX = 65536;
+
+KeyPool::KeyPool(){
+    m_chunks = nullptr;
+    m_numChunks = 0;
+    m_chunkSlots = 0;
+    m_next = nullptr;
+    m_left = 0;
+    m_chunkSize = KEYCHUNKMIN;
+    m_bytes = 0;
+    m_used = 0;
+}
+
+// deallocates every chunk, which releases all keys stored in the pool
+KeyPool::~KeyPool(){
+    for (int i = 0; i < m_numChunks; i++) {
+        delete[] m_chunks[i];
+    }
+    delete[] m_chunks;
+}
+
+// copies the key bytes to the end of the last chunk
+char* KeyPool::store(const char* key, unsigned int len){
+    char* dest = take(len);
+    memcpy(dest, key, len);
+    return dest;
+}
+
+// the length goes in front of the key bytes, the returned pointer is to the key bytes
+char* KeyPool::storeWithLength(const char* key, unsigned int len){
+    char* dest = take(sizeof(len) + len);
+    memcpy(dest, &len, sizeof(len));
+    memcpy(dest + sizeof(len), key, len);
+    return dest + sizeof(len);
+}
+
+// allocates a new chunk if len bytes do not fit into the last one, a key that
+// is larger than a chunk gets a chunk of its own
+char* KeyPool::take(unsigned int len){
+    if (m_next == nullptr || len > m_left) {
+        unsigned int size = (len > m_chunkSize) ? len : m_chunkSize;
+        if (m_numChunks == m_chunkSlots) {
+            // grow the chunk array, the chunks themselves never move
+            int slots = (m_chunkSlots == 0) ? 8 : m_chunkSlots * 2;
+            char** chunks = new char*[slots];
+            for (int i = 0; i < m_numChunks; i++) {
+                chunks[i] = m_chunks[i];
+            }
+            delete[] m_chunks;
+            m_chunks = chunks;
+            m_chunkSlots = slots;
+        }
+        m_chunks[m_numChunks++] = new char[size];
+        m_bytes += size;
+        m_next = m_chunks[m_numChunks - 1];
+        m_left = size;
+        if (m_chunkSize < KEYCHUNKMAX) {
+            m_chunkSize *= 2;
+        }
+    }
+    char* dest = m_next;
+    m_next += len;
+    m_left -= len;
+    m_used += len;
+    return dest;
+}
+
+// appends the chunk pointers of other, the chunks themselves do not move
+// the pool keeps filling its own last chunk, other is left empty
+void KeyPool::adopt(KeyPool& other){
+    if (m_numChunks + other.m_numChunks > m_chunkSlots) {
+        int slots = (m_chunkSlots == 0) ? 8 : m_chunkSlots;
+        while (slots < m_numChunks + other.m_numChunks) {
+            slots *= 2;
+        }
+        char** chunks = new char*[slots];
+        for (int i = 0; i < m_numChunks; i++) {
+            chunks[i] = m_chunks[i];
+        }
+        delete[] m_chunks;
+        m_chunks = chunks;
+        m_chunkSlots = slots;
+    }
+    for (int i = 0; i < other.m_numChunks; i++) {
+        m_chunks[m_numChunks++] = other.m_chunks[i];
+    }
+    m_bytes += other.m_bytes;
+    m_used += other.m_used;
+    other.m_numChunks = 0;
+    other.m_next = nullptr;
+    other.m_left = 0;
+    other.m_bytes = 0;
+    other.m_used = 0;
+}
+
+size_t KeyPool::bytes() const{
+    return m_bytes;
+}
+
+size_t KeyPool::used() const{
+    return m_used;
+}
+
+/*************************************
+********* LatencyHistogram ***********
+*************************************/
+
+LatencyHistogram::LatencyHistogram(){
+    reset();
+}
+
+// one relaxed add, the maximum is only written when it grows
+void LatencyHistogram::record(uint64_t nanos){
+    m_counts[bucketOf(nanos)].fetch_add(1, memory_order_relaxed);
+    m_total.fetch_add(nanos, memory_order_relaxed);
+    uint64_t max = m_max.load(memory_order_relaxed);
+    while (nanos > max && !m_max.compare_exchange_weak(max, nanos, memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other){
+    for (int b = 0; b < LATENCYBUCKETS; b++) {
+        m_counts[b].fetch_add(other.m_counts[b].load(memory_order_relaxed), memory_order_relaxed);
+    }
+    m_total.fetch_add(other.m_total.load(memory_order_relaxed), memory_order_relaxed);
+    uint64_t otherMax = other.m_max.load(memory_order_relaxed);
+    uint64_t max = m_max.load(memory_order_relaxed);
+    while (otherMax > max && !m_max.compare_exchange_weak(max, otherMax, memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset(){
+    for (int b = 0; b < LATENCYBUCKETS; b++) {
+        m_counts[b].store(0, memory_order_relaxed);
+    }
+    m_total.store(0, memory_order_relaxed);
+    m_max.store(0, memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const{
+    uint64_t count = 0;
+    for (int b = 0; b < LATENCYBUCKETS; b++) {
+        count += m_counts[b].load(memory_order_relaxed);
+    }
+    return count;
+}
+
+// walks the buckets up to the one that holds the operation of that rank
+// the result is the top of the bucket, but never above the longest time
+uint64_t LatencyHistogram::percentile(double fraction) const{
+    uint64_t count = this->count();
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(fraction * count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t max = m_max.load(memory_order_relaxed);
+    uint64_t seen = 0;
+    for (int b = 0; b < LATENCYBUCKETS; b++) {
+        seen += m_counts[b].load(memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t top = bucketTop(b);
+            return (top < max) ? top : max;
+        }
+    }
+    return max;
+}
+
+// the buckets are read one by one while other threads may record,
+// so the percentiles of a histogram in use are close but not exact
+LatencySummary LatencyHistogram::summary() const{
+    LatencySummary summary;
+    summary.m_count = count();
+    summary.m_mean = (summary.m_count == 0) ? 0.0
+                   : static_cast<double>(m_total.load(memory_order_relaxed)) / summary.m_count;
+    summary.m_p50 = percentile(0.5);
+    summary.m_p90 = percentile(0.9);
+    summary.m_p99 = percentile(0.99);
+    summary.m_p999 = percentile(0.999);
+    summary.m_max = m_max.load(memory_order_relaxed);
+    return summary;
+}
+
+// times below LATENCYSUBBUCKETS have a bucket each, a longer time goes by its
+// highest bit and the LATENCYSUBBITS bits below it
+int LatencyHistogram::bucketOf(uint64_t nanos){
+    if (nanos < static_cast<uint64_t>(LATENCYSUBBUCKETS)) {
+        return static_cast<int>(nanos);
+    }
+#if defined(__GNUC__)
+    int high = 63 - __builtin_clzll(nanos);
+#else
+    int high = floorLog2(nanos);
+#endif
+    if (high >= LATENCYRANGE) {
+        return LATENCYBUCKETS - 1;
+    }
+    int shift = high - LATENCYSUBBITS;
+    int sub = static_cast<int>(nanos >> shift) - LATENCYSUBBUCKETS;
+    return (shift + 1) * LATENCYSUBBUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::bucketTop(int bucket){
+    if (bucket < LATENCYSUBBUCKETS) {
+        return static_cast<uint64_t>(bucket);
+    }
+    int shift = bucket / LATENCYSUBBUCKETS - 1;
+    uint64_t sub = static_cast<uint64_t>(bucket % LATENCYSUBBUCKETS + LATENCYSUBBUCKETS);
+    return ((sub + 1) << shift) - 1;
+}
+
+/*************************************
+*************** Traces ***************
+*************************************/
+
+static const char TRACEOPS[] = {'I', 'R', 'G', 'U'};
+// longest key a trace may hold, a longer length means the line is broken
+const size_t MAXTRACEKEY = 1 << 20;
+
+void writeTraceRecord(ostream& out, const TraceRecord& record) {
+    out << record.m_nanos << ' ' << TRACEOPS[record.m_op] << ' ' << record.m_id << ' '
+        << record.m_newID << ' ' << record.m_key.length() << ' ';
+    out.write(record.m_key.data(), record.m_key.length());
+    out << '\n';
+}
+
+bool readTrace(istream& in, vector<TraceRecord>& records) {
+    TraceRecord record;
+    char op;
+    size_t len;
+    while (in >> record.m_nanos >> op >> record.m_id >> record.m_newID >> len) {
+        const char* found = static_cast<const char*>(memchr(TRACEOPS, op, sizeof(TRACEOPS)));
+        if (found == nullptr || in.get() != ' ') {
+            return false;
+        }
+        record.m_op = static_cast<op_t>(found - TRACEOPS);
+        if (len > MAXTRACEKEY) {
+            return false;
+        }
+        record.m_key.resize(len);
+        if (!in.read(&record.m_key[0], len) || in.get() != '\n') {
+            return false;
+        }
+        records.push_back(record);
+    }
+    // only the end of the input may stop the loop
+    return in.eof();
+}
+
+TraceRecorder::TraceRecorder(ostream& out) : m_out(out) {
+    m_start = chrono::steady_clock::now();
+    m_count = 0;
+}
+
+// the time is taken under the lock, so the lines are in the order of their times
+void TraceRecorder::record(op_t op, string_view key, int id, int newID) {
+    TraceRecord record;
+    record.m_op = op;
+    record.m_key = string(key);
+    record.m_id = id;
+    record.m_newID = newID;
+    lock_guard<mutex> lock(m_lock);
+    record.m_nanos = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now() - m_start).count());
+    writeTraceRecord(m_out, record);
+    m_count++;
+}
+
+uint64_t TraceRecorder::count() const {
+    lock_guard<mutex> lock(m_lock);
+    return m_count;
+}
+
+/*************************************
+********** Private Functions**********
+*************************************/
+
+// incrementally transfer elements from the old has table to the current hash table
+// designed to spread out the cost of rehashing
+// every insert and remove scans the same bounded number of old buckets
+void Cache::incrementalTransfer() {
+    transferBuckets(m_transferStep);
+}
+
+// transfers the live records of the next buckets old buckets to the current table
+// and deallocates the old table once every bucket has been scanned
+void Cache::transferBuckets(size_t buckets) {
+    // there is no old hash table to transfer ove
+    if (m_oldTable == nullptr) {
+        return;
+    }
+    t_migrationWork = true;
+
+#ifndef CACHE_NO_METRICS
+    chrono::steady_clock::time_point began = chrono::steady_clock::now();
+    size_t moved = 0;
+#endif
+
+    // the range of the transfer
+    size_t start = m_transferIndex;
+    size_t end = m_oldCap;
+    if (buckets < m_oldCap - start) {
+        end = start + buckets;
+    }
+
+    // the pass that reaches the end retires the old table right after,
+    // the slots it empties need no deleted markers
+    bool lastPass = (end == m_oldCap);
+
+    // transfer elements from the old table from the transfer range
+    for (size_t j = start; j < end; j++) {
+        if (isLive(m_oldCtrl[j])) {
+            const Slot& oldSlot = m_oldTable[j];
+
+            // the stored hash is reused, the key is not hashed again,
+            // and with a key handoff its bytes are not copied either
+            insertRecord(oldSlot.keyData(), oldSlot.keyLength(), oldSlot.m_hash, oldSlot.getID());
+            
+            // the old slot becomes a deleted marker, not an empty one, so that
+            // records further down its probe chain can still be found in the old table
+            // a record that is in both tables for a moment is the same record
+            if (!lastPass) {
+                setCtrl(m_oldCtrl, m_oldCap, j, DELETED);
+                m_oldNumDeleted++;
+            }
+#ifndef CACHE_NO_METRICS
+            moved++;
+#endif
+        }
+    }
+
+    // update the transfer progress
+    m_transferIndex = end;
+#ifndef CACHE_NO_METRICS
+    countMetric(MetricStripe::MIGRATED, moved);
+    countMetric(MetricStripe::MIGRATENANOS, static_cast<uint64_t>(
+        chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - began).count()));
+#endif
+
+    // if transfer is complete, clean up the old table
+    if (m_transferIndex >= m_oldCap) {
+        // lookups running alongside may still be in the old table,
+        // so it is retired rather than deallocated
+        Slot* oldTable = m_oldTable;
+        storeShared(m_oldTable, static_cast<Slot*>(nullptr));
+        if (m_handoffKeys) {
+            // the moved records still point into the old key chunks
+            m_currentKeys->adopt(*m_oldKeys);
+        }
+        retireTable(oldTable, m_oldCtrl, m_oldKeys);
+        storeShared(m_oldCtrl, static_cast<unsigned char*>(nullptr));
+        m_oldKeys = nullptr;
+        storeShared(m_oldCap, static_cast<size_t>(0));
+        storeShared(m_oldMod, static_cast<uint64_t>(0));
         m_oldSize = 0;
         m_oldNumDeleted = 0;
         m_transferIndex = 0;
+        m_transferStep = 0;
+        m_handoffKeys = false;
     }
 }
 
-// computes the next index to probe in the hash table based in parameter probe policy
-// returns the next index to check in the table
-int Cache::probeIndex(int baseIndex, int i, prob_t policy, int cap, hash_fn hash, const string& key) const {
-    if (policy == LINEAR) {
-        // each step moves forward by 1
-        return (baseIndex + i) % cap;
-    } else if (policy == QUADRATIC) {
-        // each steps move quadratically
-        return (baseIndex + i * i) % cap;
-    } else if (policy == DOUBLEHASH) {
-        // index = ((Hash(key) % TableSize) + i x (11-Hash(key) % 11))) % TableSize
-        int step = 11 - (hash(key) % 11);
-        return (baseIndex + i * step) % cap;
+// prefetches the control byte and the slot of the home bucket of hash in both tables
+// a prefetch never faults, a table that changes meanwhile only costs a wasted prefetch
+void Cache::prefetchHome(unsigned int hash) const {
+#if defined(__GNUC__)
+    const Slot* table = loadShared(m_currentTable);
+    const unsigned char* ctrl = loadShared(m_currentCtrl);
+    size_t index = fastMod(hash, loadShared(m_currentMod), loadShared(m_currentCap));
+    __builtin_prefetch(ctrl + index);
+    __builtin_prefetch(table + index);
+
+    const Slot* oldTable = loadShared(m_oldTable);
+    if (oldTable != nullptr) {
+        size_t oldIndex = fastMod(hash, loadShared(m_oldMod), loadShared(m_oldCap));
+        __builtin_prefetch(loadShared(m_oldCtrl) + oldIndex);
+        __builtin_prefetch(oldTable + oldIndex);
     }
+#else
+    (void)hash;
+#endif
+}
+
+// body of the migrator thread
+// sleeps until a rehash starts, then moves one budget of old buckets at a time,
+// dropping the lock in between so that writers get their turn
+void Cache::migrate() {
+    unique_lock<recursive_mutex> lock(m_writeLock);
+    while (!m_stopMigrator) {
+        if (m_oldTable == nullptr) {
+            m_rehashStarted.wait(lock);
+            continue;
+        }
+        // the migrator only fills free slots of the current table, a lookup needs
+        // no retry for that, unless ROBINHOOD moves live records or the old table goes
+        bool visible = (m_currProbing == ROBINHOOD) || (m_oldCap - m_transferIndex <= m_transferBudget);
+        if (visible) {
+            beginWrite();
+        }
+        transferBuckets(m_transferBudget);
+        if (visible) {
+            endWrite();
+        }
+        lock.unlock();
+        this_thread::yield();
+        lock.lock();
+    }
+}
 
-    // default return the base index - should not happen
-    return baseIndex;
+// holds the write lock while other threads may use the cache, otherwise nothing
+unique_lock<recursive_mutex> Cache::writeLock() const {
+    if (m_sharedReads || m_background.load(memory_order_acquire)) {
+        return unique_lock<recursive_mutex>(m_writeLock);
+    }
+    return unique_lock<recursive_mutex>(m_writeLock, defer_lock);
+}
+
+// a writer makes the sequence number odd while it changes the tables
+// and even again when it is done, it holds the write lock meanwhile
+// sections nest, a change made of several writes (the move of updateID)
+// is seen by lookups as a whole
+void Cache::beginWrite() {
+    if (m_writeDepth++ > 0) {
+        return;
+    }
+    m_seq.store(m_seq.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+void Cache::endWrite() {
+    if (--m_writeDepth > 0) {
+        return;
+    }
+    m_seq.store(m_seq.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+// returns true if no writer started since a lookup read the sequence number seq
+bool Cache::seqUnchanged(uint64_t seq) const {
+    atomic_thread_fence(memory_order_acquire);
+    return m_seq.load(memory_order_relaxed) == seq;
+}
+
+// takes a table out of use, it is deallocated at once when no lookup can be
+// reading it, otherwise once the lookups that started before have finished
+void Cache::retireTable(Slot* table, unsigned char* ctrl, KeyPool* keys) {
+    if (!m_sharedReads && !m_background.load(memory_order_acquire)) {
+        delete[] table;
+        delete[] ctrl;
+        delete keys;   // releases the key bytes of the table at once
+        return;
+    }
+    RetiredTable* retired = new RetiredTable;
+    retired->m_table = table;
+    retired->m_ctrl = ctrl;
+    retired->m_keys = keys;
+    atomic_thread_fence(memory_order_seq_cst);
+    // lookups that start from now on read the epoch after, they cannot find the table
+    retired->m_epoch = g_epoch.fetch_add(1);
+    retired->m_next = m_retired;
+    m_retired = retired;
+    reclaimTables(false);
+}
+
+// deallocates the retired tables no lookup can be reading any more, or all of them
+void Cache::reclaimTables(bool all) {
+    uint64_t oldest = UINT64_MAX;   // oldest epoch a running lookup started in
+    if (!all) {
+        if (g_unslottedReaders.load() != 0) {
+            oldest = 0;
+        }
+        for (int i = 0; i < MAXREADERS && oldest != 0; i++) {
+            uint64_t epoch = g_readerEpochs[i].m_epoch.load();
+            if (epoch != 0 && epoch < oldest) {
+                oldest = epoch;
+            }
+        }
+    }
+
+    RetiredTable** link = &m_retired;
+    while (*link != nullptr) {
+        RetiredTable* retired = *link;
+        if (all || retired->m_epoch < oldest) {
+            delete[] retired->m_table;
+            delete[] retired->m_ctrl;
+            delete retired->m_keys;
+            *link = retired->m_next;
+            delete retired;
+        } else {
+            link = &retired->m_next;
+        }
+    }
+}
+
+// returns the hash used to pick the home bucket of a record
+unsigned int Cache::bucketHash(string_view key, int id) const {
+    return combineID(keyHash(key), id);
+}
+
+// calls the hash function of the cache on a key
+// a hash function of the old signature gets a copy of the key
+unsigned int Cache::keyHash(string_view key) const {
+    return (m_viewHash != nullptr) ? m_viewHash(key) : m_hash(string(key));
+}
+
+// turns the hash of a key into the bucket hash of the record (key, id)
+// in COMPOSITEHASH mode the ID is mixed into the key hash so that records
+// sharing a key are spread over the whole table
+unsigned int Cache::combineID(unsigned int keyHash, int id) const {
+    unsigned int h = keyHash;
+    if (m_hashing == COMPOSITEHASH) {
+        // hash_combine step followed by the murmur3 finalizer
+        h ^= static_cast<unsigned int>(id) + 0x9e3779b9u + (h << 6) + (h >> 2);
+        h = mix32(h);
+    }
+    return h;
+}
+
+// allocates a table of cap slots
+Slot* Cache::allocTable(size_t cap) {
+    Slot* table = new Slot[cap];
+    for (size_t j = 0; j < cap; j++) {
+        table[j].m_key = 0;
+        table[j].m_hash = 0;
+        table[j].m_info = 0;
+    }
+    return table;
+}
+
+// allocates the control bytes of a table of cap slots, all of them empty
+// the first GROUPWIDTH-1 bytes are mirrored after the end so that a group
+// can be loaded at any index without wrapping around
+unsigned char* Cache::allocCtrl(size_t cap) {
+    unsigned char* ctrl = new unsigned char[cap + GROUPWIDTH - 1];
+    memset(ctrl, EMPTY, cap + GROUPWIDTH - 1);
+    return ctrl;
+}
+
+// writes a control byte and its mirror copy if it has one
+void Cache::setCtrl(unsigned char* ctrl, size_t cap, size_t index, unsigned char value) {
+    storeCtrl(ctrl, index, value);
+    if (index < static_cast<size_t>(GROUPWIDTH - 1)) {
+        storeCtrl(ctrl, cap + index, value);
+    }
+}
+
+// inserts a record into the current table with its probing policy
+// returns false if no free slot was found on the probe sequence
+bool Cache::insertRecord(const char* key, unsigned int len, unsigned int hash, int id) {
+    if (m_currProbing == ROBINHOOD) {
+        return placeRobinHood(fastMod(hash, m_currentMod, m_currentCap), 0, key, len, hash, id, m_handoffKeys);
+    }
+    size_t index = findFree(m_currentCtrl, m_currentCap, m_currentMod, m_currProbing, hash);
+    if (index == NOSLOT) {
+        return false;
+    }
+    placeRecord(index, key, len, hash, id, m_handoffKeys);
+    return true;
+}
+
+// returns the key word for a record that goes into the given non-live slot
+// a short key is copied into the word itself, a longer one into the key pool
+// the bytes left behind in the slot by its last record are overwritten when the key fits,
+// unless lookups run alongside: they may still be comparing those bytes
+// with handoff a longer key already lives in a pool of the cache and is not copied
+uint64_t Cache::storeKey(size_t index, const char* key, unsigned int len, bool handoff) {
+    if (len <= INLINEKEY) {
+        uint64_t word = 0;
+        memcpy(&word, key, len);
+        return word;
+    }
+    if (handoff) {
+        return reinterpret_cast<uintptr_t>(key);
+    }
+    if (len >= LONGKEY) {
+        return reinterpret_cast<uintptr_t>(m_currentKeys->storeWithLength(key, len));
+    }
+    Slot& slot = m_currentTable[index];
+    unsigned int oldLen = slot.m_info >> IDBITS;
+    if (!m_sharedReads && !m_background.load(memory_order_acquire) &&
+        oldLen > INLINEKEY && oldLen < LONGKEY && oldLen >= len) {
+        memcpy(reinterpret_cast<char*>(static_cast<uintptr_t>(slot.m_key)), key, len);
+        return slot.m_key;
+    }
+    return reinterpret_cast<uintptr_t>(m_currentKeys->store(key, len));
+}
+
+// writes a record into an empty or deleted slot of the current table and marks it live
+void Cache::placeRecord(size_t index, const char* key, unsigned int len, unsigned int hash, int id,
+                        bool handoff) {
+    Slot& slot = m_currentTable[index];
+    if (m_currentCtrl[index] == DELETED) {
+        // a reused deleted slot was already counted in m_currentSize
+        m_currNumDeleted--;
+    } else {
+        m_currentSize++;
+    }
+    Slot record;
+    record.m_key = storeKey(index, key, len, handoff);
+    record.m_hash = hash;
+    record.m_info = slotInfo(id, len);
+    writeSlot(slot, record);
+    setCtrl(m_currentCtrl, m_currentCap, index, fingerprint(hash));
+    m_currentKeyBytes += poolBytes(len);
+}
+
+// inserts a record into the current ROBINHOOD table
+// walking linearly from the home bucket, the carried record takes the place
+// of the first record that is closer to its own home bucket, and that record
+// is carried on, until an empty slot ends the cluster
+// the walk starts at start, dist buckets from home, a caller that already
+// walked past records the new one cannot displace passes where it stopped
+bool Cache::placeRobinHood(size_t start, size_t dist, const char* key, unsigned int len,
+                           unsigned int hash, int id, bool handoff) {
+    // the displacement always ends at the first empty slot after the start
+    size_t last = start;
+    size_t probed = dist;
+    while (m_currentCtrl[last] != EMPTY) {
+        if (++probed >= m_currentCap) {
+            return false;   // table is full
+        }
+        last = (last + 1 == m_currentCap) ? 0 : last + 1;
+    }
+
+    // the key bytes can take over the buffer left in that slot
+    Slot carried;
+    carried.m_key = storeKey(last, key, len, handoff);
+    carried.m_hash = hash;
+    carried.m_info = slotInfo(id, len);
+
+    size_t pos = start;
+    while (pos != last) {
+        Slot& slot = m_currentTable[pos];
+        size_t slotDist = homeDistance(slot.m_hash, pos, m_currentMod, m_currentCap);
+        if (slotDist < dist) {
+            // the record in the slot is richer, it gives its place up
+            Slot evicted = slot;
+            writeSlot(slot, carried);
+            setCtrl(m_currentCtrl, m_currentCap, pos, fingerprint(carried.m_hash));
+            carried = evicted;
+            dist = slotDist;
+        }
+        dist++;
+        pos = (pos + 1 == m_currentCap) ? 0 : pos + 1;
+    }
+    writeSlot(m_currentTable[last], carried);
+    setCtrl(m_currentCtrl, m_currentCap, last, fingerprint(carried.m_hash));
+    m_currentSize++;
+    m_currentKeyBytes += poolBytes(len);
+    return true;
+}
+
+// removes the record at index from the current ROBINHOOD table
+// the following records of the cluster move back one slot each, so the
+// table never holds deleted markers
+void Cache::backwardShift(size_t index) {
+    uint64_t freedKey = m_currentTable[index].m_key;
+    unsigned int freedInfo = m_currentTable[index].m_info;
+
+    size_t hole = index;
+    size_t next = (hole + 1 == m_currentCap) ? 0 : hole + 1;
+    while (isLive(m_currentCtrl[next]) &&
+           homeDistance(m_currentTable[next].m_hash, next, m_currentMod, m_currentCap) > 0) {
+        writeSlot(m_currentTable[hole], m_currentTable[next]);
+        setCtrl(m_currentCtrl, m_currentCap, hole, m_currentCtrl[next]);
+        hole = next;
+        next = (hole + 1 == m_currentCap) ? 0 : hole + 1;
+    }
+
+    // the emptied slot keeps the bytes of the removed key for the next insert
+    storeShared(m_currentTable[hole].m_key, freedKey);
+    storeShared(m_currentTable[hole].m_info, freedInfo);
+    setCtrl(m_currentCtrl, m_currentCap, hole, EMPTY);
+    m_currentSize--;
+}
+
+// copies a record into a slot field by field, lookups may read the slot meanwhile
+void Cache::writeSlot(Slot& slot, const Slot& value) {
+    storeShared(slot.m_key, value.m_key);
+    storeShared(slot.m_hash, value.m_hash);
+    storeShared(slot.m_info, value.m_info);
+}
+
+// changes the ID of a live slot, its key length stays
+void Cache::setSlotID(Slot& slot, int id) {
+    storeShared(slot.m_info, (slot.m_info & ~IDMASK) | static_cast<unsigned int>(id));
+}
+
+// compares a live slot with (hash, key, id), the stored hash first, the key bytes
+// are only read when the hash, the ID and the length all match
+// a short key is compared in the key word just loaded, nothing is followed for it
+// a lookup running alongside writers passes the sequence number it started at,
+// the slot fields have to be confirmed unchanged before the key pointer is followed
+bool Cache::slotMatches(const Slot& slot, unsigned int hash, string_view key, int id, uint64_t seq) const {
+    if (loadShared(slot.m_hash) != hash) {
+        return false;
+    }
+    unsigned int info = loadShared(slot.m_info);
+    if (static_cast<int>(info & IDMASK) != id) {
+        return false;
+    }
+    unsigned int len = info >> IDBITS;
+    if (len != ((key.length() < LONGKEY) ? key.length() : LONGKEY)) {
+        return false;
+    }
+    uint64_t word = loadShared(slot.m_key);
+    if (len <= INLINEKEY) {
+        return memcmp(&word, key.data(), len) == 0;
+    }
+    if (seq != NOSEQ && !seqUnchanged(seq)) {
+        return false;   // the lookup is repeated anyway
+    }
+    const char* bytes = reinterpret_cast<const char*>(static_cast<uintptr_t>(word));
+    if (len == LONGKEY) {
+        memcpy(&len, bytes - sizeof(len), sizeof(len));
+        if (len != key.length()) {
+            return false;
+        }
+    }
+    return memcmp(bytes, key.data(), len) == 0;
+}
+
+// returns the index of the live slot holding (key, id) in the given table, NOSLOT if there is none
+// the control byte is checked first, the slot is only read when its fingerprint matches
+size_t Cache::findRecord(const Slot* table, const unsigned char* ctrl, size_t cap, uint64_t mod, prob_t policy,
+                         unsigned int hash, string_view key, int id, uint64_t seq) const {
+    unsigned char h2 = fingerprint(hash);
+    ProbeSeq probe(hash, policy, cap, mod);
+    size_t found = NOSLOT;
+
+    if (policy == SWISS) {
+        // scan GROUPWIDTH control bytes at a time, a group with an empty
+        // byte ends the probe sequence
+        for (; !probe.done() && found == NOSLOT; probe.next()) {
+            size_t pos = probe.index();
+            const unsigned char* group = ctrl + pos;
+            for (unsigned int bits = matchByte(group, h2); bits != 0 && found == NOSLOT; bits &= bits - 1) {
+                size_t j = pos + lowestBit(bits);
+                if (j >= cap) {
+                    j -= cap;
+                }
+                // the group load is only a filter, the byte itself is
+                // loaded again before the slot is read
+                if (loadCtrl(ctrl, j) == h2 && slotMatches(table[j], hash, key, id, seq)) {
+                    found = j;
+                }
+            }
+            if (found != NOSLOT || matchByte(group, EMPTY) != 0) {
+                break;
+            }
+        }
+    } else if (policy == ROBINHOOD) {
+        // a record is never further from its home bucket than a record it
+        // passed, so the search stops at the first slot that is closer to home
+        // deleted markers only exist in an old table, they keep the hash of their
+        // record, so their distance from home still counts
+        for (; !probe.done(); probe.next()) {
+            size_t pos = probe.index();
+            unsigned char c = loadCtrl(ctrl, pos);
+            if (c == EMPTY || homeDistance(loadShared(table[pos].m_hash), pos, mod, cap) < probe.probed()) {
+                break;  // not found
+            }
+            if (c == h2 && slotMatches(table[pos], hash, key, id, seq)) {
+                found = pos;
+                break;
+            }
+        }
+    } else {
+        // probe through the table until the record or an empty slot is found
+        for (; !probe.done(); probe.next()) {
+            size_t pos = probe.index();
+            unsigned char c = loadCtrl(ctrl, pos);
+            if (c == EMPTY) {
+                break;  // not found
+            }
+            if (c == h2 && slotMatches(table[pos], hash, key, id, seq)) {
+                found = pos;
+                break;
+            }
+        }
+    }
+
+    countMetric(MetricStripe::SEARCHES);
+    countMetric(MetricStripe::PROBES, probe.steps());
+    return found;
+}
+
+// the single probe of an insert into the current table, the caller holds the write lock
+// returns true if (key, id) is live in the table, otherwise index is the slot the
+// record goes to, NOSLOT if there is none, and dist its distance from home
+// a deleted slot is only reused once the rest of the chain holds no duplicate;
+// for ROBINHOOD index is where the search stopped, placeRobinHood starts there
+bool Cache::findInsertSlot(unsigned int hash, string_view key, int id, size_t& index, size_t& dist) const {
+    const unsigned char* ctrl = m_currentCtrl;
+    size_t cap = m_currentCap;
+    unsigned char h2 = fingerprint(hash);
+    ProbeSeq probe(hash, m_currProbing, cap, m_currentMod);
+    bool duplicate = false;
+    index = NOSLOT;
+    dist = 0;
+
+    if (m_currProbing == SWISS) {
+        for (; !probe.done(); probe.next()) {
+            size_t pos = probe.index();
+            const unsigned char* group = ctrl + pos;
+            for (unsigned int bits = matchByte(group, h2); bits != 0 && !duplicate; bits &= bits - 1) {
+                size_t j = pos + lowestBit(bits);
+                if (j >= cap) {
+                    j -= cap;
+                }
+                duplicate = slotMatches(m_currentTable[j], hash, key, id, NOSEQ);
+            }
+            unsigned int free = matchFree(group);
+            if (index == NOSLOT && free != 0) {
+                size_t j = pos + lowestBit(free);
+                index = (j >= cap) ? j - cap : j;
+            }
+            if (duplicate || matchByte(group, EMPTY) != 0) {
+                break;
+            }
+        }
+    } else if (m_currProbing == ROBINHOOD) {
+        // a current ROBINHOOD table has no deleted markers
+        for (; !probe.done(); probe.next()) {
+            size_t pos = probe.index();
+            unsigned char c = ctrl[pos];
+            if (c == EMPTY || homeDistance(m_currentTable[pos].m_hash, pos, m_currentMod, cap) < probe.probed()) {
+                index = pos;
+                dist = probe.probed();
+                break;
+            }
+            if (c == h2 && slotMatches(m_currentTable[pos], hash, key, id, NOSEQ)) {
+                duplicate = true;
+                break;
+            }
+        }
+    } else {
+        for (; !probe.done(); probe.next()) {
+            size_t pos = probe.index();
+            unsigned char c = ctrl[pos];
+            if (c == EMPTY) {
+                if (index == NOSLOT) {
+                    index = pos;
+                }
+                break;
+            }
+            if (c == DELETED) {
+                if (index == NOSLOT) {
+                    index = pos;    // first reusable slot
+                }
+            } else if (c == h2 && slotMatches(m_currentTable[pos], hash, key, id, NOSEQ)) {
+                duplicate = true;
+                break;
+            }
+        }
+    }
+
+    countMetric(MetricStripe::SEARCHES);
+    countMetric(MetricStripe::PROBES, probe.steps());
+    return duplicate;
+}
+
+// returns the index of the first empty or deleted slot on the probe sequence of hash,
+// NOSLOT if the whole sequence is live
+size_t Cache::findFree(const unsigned char* ctrl, size_t cap, uint64_t mod, prob_t policy, unsigned int hash) const {
+    ProbeSeq probe(hash, policy, cap, mod);
+
+    if (policy == SWISS) {
+        for (; !probe.done(); probe.next()) {
+            unsigned int bits = matchFree(ctrl + probe.index());
+            if (bits != 0) {
+                size_t j = probe.index() + lowestBit(bits);
+                return (j >= cap) ? j - cap : j;
+            }
+        }
+        return NOSLOT;
+    }
+
+    for (; !probe.done(); probe.next()) {
+        if (!isLive(ctrl[probe.index()])) {
+            return probe.index();
+        }
+    }
+    return NOSLOT;   // the entire table has been probed
+}
+
+// returns the load factor above which the current table is rehashed
+// group probing stays short at much higher loads than single slot probing
+float Cache::maxLoad(prob_t policy) const {
+    return (policy == SWISS) ? 0.875f : 0.5f;
+}
+
+// fills stats for one table, a table that does not exist gets capacity 0
+// the probe length of a record is found by walking its probe sequence from home,
+// for LINEAR, ROBINHOOD and SWISS it follows from the distance to home directly
+void Cache::analyzeTable(const Slot* table, const unsigned char* ctrl, size_t cap, uint64_t mod, prob_t policy,
+                         TableStats& stats) const {
+    stats.m_capacity = 0;
+    stats.m_probing = policy;
+    stats.m_live = 0;
+    stats.m_deleted = 0;
+    stats.m_averageProbe = 0.0;
+    stats.m_maxProbe = 0;
+    stats.m_maxDisplacement = 0;
+    stats.m_clusters = 0;
+    stats.m_maxCluster = 0;
+    for (int k = 0; k < PROBEBUCKETS; k++) {
+        stats.m_probeHistogram[k] = 0;
+    }
+    for (int k = 0; k < CLUSTERBUCKETS; k++) {
+        stats.m_clusterHistogram[k] = 0;
+    }
+    for (int k = 0; k < DENSITYREGIONS; k++) {
+        stats.m_regionDeleted[k] = 0.0;
+    }
+    if (table == nullptr) {
+        return;
+    }
+    stats.m_capacity = cap;
+
+    size_t regionDeleted[DENSITYREGIONS] = {0};
+    size_t totalProbe = 0;
+    for (size_t j = 0; j < cap; j++) {
+        if (ctrl[j] == DELETED) {
+            stats.m_deleted++;
+            regionDeleted[j * DENSITYREGIONS / cap]++;
+        }
+        if (!isLive(ctrl[j])) {
+            continue;
+        }
+        stats.m_live++;
+        ProbeSeq probe(table[j].m_hash, policy, cap, mod);
+        size_t home = probe.index();
+        size_t displacement = (j >= home) ? j - home : j + cap - home;
+        size_t length;
+        if (policy == LINEAR || policy == ROBINHOOD) {
+            length = displacement + 1;
+        } else if (policy == SWISS) {
+            length = displacement / GROUPWIDTH + 1;
+        } else {
+            length = 1;
+            while (probe.index() != j && !probe.done()) {
+                probe.next();
+                length++;
+            }
+        }
+        totalProbe += length;
+        if (length > stats.m_maxProbe) {
+            stats.m_maxProbe = length;
+        }
+        if (displacement > stats.m_maxDisplacement) {
+            stats.m_maxDisplacement = displacement;
+        }
+        stats.m_probeHistogram[(length < static_cast<size_t>(PROBEBUCKETS)) ? length - 1 : PROBEBUCKETS - 1]++;
+    }
+    if (stats.m_live > 0) {
+        stats.m_averageProbe = static_cast<double>(totalProbe) / stats.m_live;
+    }
+    for (int k = 0; k < DENSITYREGIONS; k++) {
+        // regions differ in size by at most one bucket
+        size_t size = (k + 1) * cap / DENSITYREGIONS - k * cap / DENSITYREGIONS;
+        stats.m_regionDeleted[k] = (size == 0) ? 0.0 : static_cast<double>(regionDeleted[k]) / size;
+    }
+
+    // clusters are runs of live or deleted buckets, a run may wrap around the end,
+    // so the walk starts right after an empty bucket
+    size_t start = 0;
+    while (start < cap && ctrl[start] != EMPTY) {
+        start++;
+    }
+    if (start == cap) {
+        stats.m_clusters = 1;     // no empty bucket at all
+        stats.m_maxCluster = cap;
+        stats.m_clusterHistogram[floorLog2(cap)]++;
+        return;
+    }
+    size_t run = 0;
+    for (size_t n = 1; n <= cap; n++) {
+        size_t j = (start + n < cap) ? start + n : start + n - cap;
+        if (ctrl[j] != EMPTY) {
+            run++;
+        } else if (run > 0) {
+            stats.m_clusters++;
+            if (run > stats.m_maxCluster) {
+                stats.m_maxCluster = run;
+            }
+            stats.m_clusterHistogram[floorLog2(run)]++;
+            run = 0;
+        }
+    }
 }
 
 // moves the current table into the old table and allocates a new larger table
 // done incrementally to spread out cost
 void Cache::startRehash() {
+    t_migrationWork = true;
+
     // saves the current table element to the old table element
-    m_oldTable = m_currentTable;
-    m_oldCap = m_currentCap;
+    // the fields lookups read are written as shared fields
+    storeShared(m_oldTable, m_currentTable);
+    storeShared(m_oldCtrl, m_currentCtrl);
+    m_oldKeys = m_currentKeys;
+    storeShared(m_oldCap, m_currentCap);
+    storeShared(m_oldMod, m_currentMod);
     m_oldSize = m_currentSize;
     m_oldNumDeleted = m_currNumDeleted;
-    m_oldProbing = m_currProbing;
+    storeShared(m_oldProbing, m_currProbing);
 
     //new capacity = new prime >= 4 x liveCount
-    int liveCount = m_currentSize - m_currNumDeleted;
-    int newSize = liveCount * 4;
-    if (newSize < MINPRIME) {
-        m_currentCap = MINPRIME;
-    } else if (newSize > MAXPRIME) {
-        m_currentCap = MAXPRIME;
-    } else if (isPrime(newSize)) {
-        m_currentCap = newSize;
-    } else {
-        m_currentCap = findNextPrime(newSize);
-    }
+    size_t liveCount = m_currentSize - m_currNumDeleted;
+    int step = ladderIndexFor(liveCount * 4);
+    size_t cap = PRIMELADDER[step].m_prime;
+    storeShared(m_currentCap, cap);
+    storeShared(m_currentMod, PRIMELADDER[step].m_mod);
 
     // allocate new table
-    m_currentTable = new Person*[m_currentCap];
-    for (int j = 0; j < m_currentCap; j++) {
-        m_currentTable[j] = nullptr;
-    }
+    storeShared(m_currentTable, allocTable(cap));
+    storeShared(m_currentCtrl, allocCtrl(cap));
+    m_currentKeys = new KeyPool();
+
+    // the records keep their key bytes where they are and the new table takes the
+    // old key chunks over at the end, unless most of those bytes belong to removed
+    // records, then the keys are copied into the new pool and the old chunks go
+    m_handoffKeys = (2 * m_currentKeyBytes >= m_oldKeys->used());
+    m_currentKeyBytes = 0;
 
     // resets the counter for the new table
     m_currentSize = 0;              // no elements yet
     m_currNumDeleted = 0;           // no deletions yet
     m_transferIndex = 0;            // starts at 0
-    m_currProbing = m_newPolicy;    // sets the new probing policy
+    storeShared(m_currProbing, m_newPolicy);    // sets the new probing policy
+
+    // buckets scanned per insert/remove: the configured budget, raised if needed
+    // so that the old table is empty before inserts alone could push the new
+    // table past its load limit, the next rehash can only start after that
+    size_t limit = static_cast<size_t>(maxLoad(m_currProbing) * m_currentCap);
+    size_t headroom = (limit > liveCount) ? limit - liveCount : 1;
+    m_transferStep = (m_oldCap + headroom - 1) / headroom;
+    if (m_transferStep < m_transferBudget) {
+        m_transferStep = m_transferBudget;
+    }
+
+    // wakes the background migrator, if there is one
+    m_rehashStarted.notify_one();
 }
@@ -3,25 +3,53 @@
 #define CACHE_H
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <vector>
 #include "math.h"
 using namespace std;
 class Grader;   // forward declaration, will be used for grdaing
 class Tester;   // forward declaration, will be used for testing
 class Person;   // forward declaration
+class Slot;     // forward declaration
+class KeyPool;  // forward declaration
+struct RetiredTable;    // forward declaration
 class Cache;    // forward declaration
-const int MINPRIME = 101;   // Min size for hash table
-const int MAXPRIME = 99991; // Max size for hash table
+const int MINPRIME = 101;   // Min size for hash table, there is no max size
+const size_t MAXINITCAP = 1 << 24;  // larger requested sizes start here and grow by rehashing
+const size_t DEFTRANSFER = 64;  // default number of old buckets moved per insert/remove
+const int BATCHBLOCK = 16;      // records of a batch whose home buckets are prefetched together
 const int MINID = 100000;
 const int MAXID = 999999;
 typedef unsigned int (*hash_fn)(string); // declaration of hash function
-enum prob_t {QUADRATIC, DOUBLEHASH, LINEAR}; // types of collision handling policy
+// hash function that reads the key in place, no string is built for the call
+typedef unsigned int (*hash_view_fn)(string_view);
+// returned by the slot searches when there is no such slot
+const size_t NOSLOT = static_cast<size_t>(-1);
+// passed to the slot searches by a caller that no writer can run alongside
+const uint64_t NOSEQ = static_cast<uint64_t>(-1);
+// types of collision handling policy
+// SWISS probes groups of control bytes at a time with SIMD compares
+// ROBINHOOD is linear probing that keeps records ordered by distance from home
+enum prob_t {QUADRATIC, DOUBLEHASH, LINEAR, SWISS, ROBINHOOD};
 #define DEFPOLCY QUADRATIC
+// what goes into the bucket hash: the key alone, or the (key, ID) pair
+// COMPOSITEHASH keeps records that share a key from piling into one probe chain
+enum hash_t {KEYHASH, COMPOSITEHASH};
+#define DEFHASH KEYHASH
 
 class Person{
     public:
     friend class Grader;
     friend class Tester;
     friend class Cache;
+    friend class ShardedCache;
     Person(string key="", int id=0, bool used=false){
         m_key = key; m_id = id; m_used=used;
     }
@@ -67,56 +95,449 @@ class Person{
     // if it is set to true, it means the bucket contains live data, and we cannot overwrite it
     bool m_used;
 };
+// control bytes, one per bucket of the hash table, kept apart from the slots
+// a live bucket stores the 7 bit fingerprint of its hash (high bit clear)
+// DELETED is the lazy delete marker, the bucket is free for insert
+// but probing has to continue past it
+const unsigned char EMPTY = 0x80;
+const unsigned char DELETED = 0xFE;
+inline bool isLive(unsigned char ctrl) {return (ctrl & 0x80) == 0;}
+inline unsigned char fingerprint(unsigned int hash) {return hash >> 25;}
+// murmur3 finalizer, spreads every input bit over the whole word
+inline unsigned int mix32(unsigned int h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+// non-owning result of a lookup, no Person and no string are built for it
+class PersonView{
+    public:
+    PersonView() : m_key(nullptr), m_len(0), m_id(0), m_used(false) {}
+    PersonView(const char* key, size_t len, int id) : m_key(key), m_len(len), m_id(id), m_used(true) {}
+    string_view getKey() const {return string_view(m_key, m_len);}
+    int getID() const {return m_id;}
+    bool getUsed() const {return m_used;}
+    // an owning copy, for keeping the record past the life of the view
+    Person toPerson() const {
+        return m_used ? Person(string(m_key, m_len), m_id, true) : Person();
+    }
+    private:
+    const char* m_key;  // key bytes, not owned
+    size_t      m_len;  // number of key bytes
+    int         m_id;   // ID of the record
+    bool        m_used; // false if the lookup found nothing
+};
+
+// one bucket of the hash table
+// the table is a contiguous array of 16-byte slots, a slot has a fixed size and
+// copies with an assignment
+// a key of up to INLINEKEY bytes is kept in the key word of the slot itself, a longer
+// one lives in the KeyPool of the table and the key word points to it
+// the ID and the key length share one word, a length of LONGKEY or more is stored
+// in the 4 bytes in front of the key bytes instead
+// the ROBINHOOD distance from home is not stored, it follows from the hash
+const unsigned int INLINEKEY = 8;       // longest key kept in the slot
+const int IDBITS = 20;                  // low bits of the info word that hold the ID
+const unsigned int IDMASK = (1u << IDBITS) - 1;
+const unsigned int LONGKEY = (1u << (32 - IDBITS)) - 1;     // length field of a key with a stored length
+static_assert(MAXID <= static_cast<int>(IDMASK), "an ID has to fit into IDBITS bits");
+
+class Slot{
+    public:
+    friend class Grader;
+    friend class Tester;
+    friend class Cache;
+    int getID() const {return static_cast<int>(m_info & IDMASK);}
+    unsigned int keyLength() const {
+        unsigned int len = m_info >> IDBITS;
+        if (len == LONGKEY) {
+            memcpy(&len, keyData() - sizeof(len), sizeof(len));
+        }
+        return len;
+    }
+    // the key bytes, in the slot itself for a short key
+    const char* keyData() const {
+        if ((m_info >> IDBITS) <= INLINEKEY) {
+            return reinterpret_cast<const char*>(&m_key);
+        }
+        return reinterpret_cast<const char*>(static_cast<uintptr_t>(m_key));
+    }
+    string getKey() const {return string(keyData(), keyLength());}
+    Person toPerson() const {
+        return Person(getKey(), getID(), true);
+    }
+    private:
+    uint64_t      m_key;    // key bytes of a short key, else where the KeyPool keeps them
+    unsigned int  m_hash;   // bucket hash of the record
+    unsigned int  m_info;   // ID in the low IDBITS bits, key length (at most LONGKEY) above
+};
+
+// append-only storage for the key bytes of one hash table
+// bytes are never moved, so slots can point into the pool, and the whole
+// pool is released at once when its table is deallocated
+class KeyPool{
+    public:
+    friend class Grader;
+    friend class Tester;
+    KeyPool();
+    ~KeyPool();
+    // copies len bytes of key into the pool and returns where they are stored
+    char* store(const char* key, unsigned int len);
+    // the same with the length stored in the 4 bytes in front of the key bytes
+    char* storeWithLength(const char* key, unsigned int len);
+    // takes over the chunks of other, keys stored there stay where they are
+    void adopt(KeyPool& other);
+    // bytes of the chunks allocated so far, and the bytes of the keys stored in them
+    size_t bytes() const;
+    size_t used() const;
+    private:
+    // returns len free bytes at the end of the last chunk
+    char* take(unsigned int len);
+    char**       m_chunks;      // array of allocated chunks
+    int          m_numChunks;   // number of chunks in use
+    int          m_chunkSlots;  // capacity of the m_chunks array
+    char*        m_next;        // next free byte in the last chunk
+    unsigned int m_left;        // free bytes left in the last chunk
+    unsigned int m_chunkSize;   // size of the next chunk, doubles up to a limit
+    size_t       m_bytes;       // bytes of all the chunks
+    size_t       m_used;        // bytes of all the keys stored
+};
+
+// a table taken out of use while lookups on other threads may still read it
+struct RetiredTable{
+    Slot*          m_table;     // slot array of the table
+    unsigned char* m_ctrl;      // control bytes of the table
+    KeyPool*       m_keys;      // key bytes of the table
+    uint64_t       m_epoch;     // reclamation epoch the table was retired in
+    RetiredTable*  m_next;      // next retired table of the cache
+};
+
+// sizes of the histograms of Cache::analyze
+const int PROBEBUCKETS = 32;    // probe lengths 1 to 31, the last bucket counts longer ones
+const int CLUSTERBUCKETS = 33;  // bucket k counts clusters of 2^k to 2^(k+1)-1 buckets
+const int DENSITYREGIONS = 16;  // equal parts of a table its deleted markers are counted in
+// output formats of Cache::writeStats
+enum stats_t {STATSJSON, STATSCSV};
+
+// what Cache::analyze found in one table
+// the probe length of a record is the number of buckets a lookup of it reads,
+// for SWISS the number of groups
+struct TableStats{
+    size_t m_capacity;          // number of buckets, 0 if there is no such table
+    prob_t m_probing;           // collision handling policy of the table
+    size_t m_live;              // live records
+    size_t m_deleted;           // deleted markers
+    double m_averageProbe;      // average probe length of a live record
+    size_t m_maxProbe;          // longest probe length of a live record
+    size_t m_maxDisplacement;   // furthest a live record is from its home bucket, in buckets
+    size_t m_probeHistogram[PROBEBUCKETS];      // live records by probe length
+    size_t m_clusters;          // runs of non-empty buckets
+    size_t m_maxCluster;        // longest run of non-empty buckets
+    size_t m_clusterHistogram[CLUSTERBUCKETS];  // runs of non-empty buckets by size
+    double m_regionDeleted[DENSITYREGIONS];     // ratio of deleted buckets in each region
+};
+
+// what Cache::analyze found in both tables
+struct CacheStats{
+    TableStats m_current;   // the table inserts go to
+    TableStats m_old;       // the table being rehashed, capacity 0 if there is none
+    double m_oldFraction;   // fraction of the live records still in the old table
+};
+
+// bytes held by the tables of one Cache, see Cache::memoryUsage
+// tables waiting for lookups on other threads to leave them are not counted
+struct CacheMemory{
+    size_t m_records;       // live records in both tables
+    size_t m_slotBytes;     // slot arrays of both tables
+    size_t m_ctrlBytes;     // control bytes of both tables
+    size_t m_keyBytes;      // chunks of both key pools, short keys take none
+    size_t m_keyUsed;       // bytes stored in those chunks, keys of removed records included
+    size_t m_totalBytes;    // slots, control bytes and key chunks
+    double m_bytesPerRecord;// m_totalBytes over m_records, the free buckets of a table included
+};
+
+// the metrics counters are compiled in unless CACHE_NO_METRICS is defined
+const int METRICSTRIPES = 8;    // sets of counters, threads are spread over them
+
+// counters of one Cache since it was built or last reset, see Cache::metrics
+// all zero when the counters are compiled out
+struct CacheMetrics{
+    bool     m_enabled;         // false when the counters are compiled out
+    uint64_t m_lookups;         // getPerson, getPersonView and batch lookups
+    uint64_t m_hits;            // lookups that found their record
+    uint64_t m_misses;          // lookups that did not
+    uint64_t m_inserts;         // records inserted
+    uint64_t m_removes;         // records removed
+    uint64_t m_updates;         // records whose ID was updated
+    uint64_t m_searches;        // probe sequences walked by lookups, inserts, removes and updates
+    uint64_t m_probes;          // buckets (SWISS: groups) read on those sequences
+    uint64_t m_tombstoneReuses; // inserts that took the slot of a deleted record
+    uint64_t m_loadRehashes;    // rehashes started by the load factor of an insert
+    uint64_t m_deletedRehashes; // rehashes started by the deleted ratio of a remove
+    uint64_t m_migrated;        // records moved from the old table to the current one
+    uint64_t m_migrateNanos;    // time spent moving old buckets, in nanoseconds
+    uint64_t m_lookupRetries;   // lock-free lookups repeated because a writer ran meanwhile
+    uint64_t m_backoffLookups;  // lock-free lookups that failed MAXRETRY times and went on yielding
+};
+
+// the latency histograms are compiled in unless CACHE_NO_LATENCY is defined,
+// and record nothing until Cache::setLatencyTracking turns them on
+// the buckets are log-linear as in HdrHistogram: every power of 2 is split into
+// LATENCYSUBBUCKETS buckets, so a time is known to within 1/16 of itself
+const int LATENCYSUBBITS = 4;
+const int LATENCYSUBBUCKETS = 1 << LATENCYSUBBITS;
+const int LATENCYRANGE = 40;    // times up to 2^40 ns (18 minutes), longer ones share the last bucket
+const int LATENCYBUCKETS = (LATENCYRANGE - LATENCYSUBBITS + 1) * LATENCYSUBBUCKETS;
+// operations with a histogram of their own
+// OPMIGRATION gets the inserts, removes and updates once more that started a
+// rehash or moved old buckets, the rehash spikes show up there
+enum op_t {OPINSERT, OPREMOVE, OPLOOKUP, OPUPDATE, OPMIGRATION, NUMOPS};
+
+// percentiles of one latency histogram, in nanoseconds
+// a percentile is the top of its bucket, at most 1/16 above the real time
+struct LatencySummary{
+    uint64_t m_count;   // operations recorded
+    double   m_mean;    // average time
+    uint64_t m_p50;
+    uint64_t m_p90;
+    uint64_t m_p99;
+    uint64_t m_p999;
+    uint64_t m_max;     // longest time, exact
+};
+
+// operation times in nanoseconds, any number of threads may record at once
+class LatencyHistogram{
+    public:
+    friend class Grader;
+    friend class Tester;
+    LatencyHistogram();
+    void record(uint64_t nanos);
+    // adds the times recorded in other, e.g. to sum up the shards of a ShardedCache
+    void merge(const LatencyHistogram& other);
+    void reset();
+    uint64_t count() const;
+    // the time the given fraction (0 to 1) of the operations stayed within
+    uint64_t percentile(double fraction) const;
+    LatencySummary summary() const;
+    // bucket of a time, and the longest time that falls into a bucket
+    static int bucketOf(uint64_t nanos);
+    static uint64_t bucketTop(int bucket);
+    private:
+    atomic<uint64_t> m_counts[LATENCYBUCKETS];  // operations per bucket
+    atomic<uint64_t> m_total;   // sum of the recorded times, for the mean
+    atomic<uint64_t> m_max;     // longest recorded time
+};
+
+// one operation of a trace, see TraceRecorder
+struct TraceRecord{
+    uint64_t m_nanos;   // time of the operation since the recording started
+    op_t     m_op;      // OPINSERT, OPREMOVE, OPLOOKUP or OPUPDATE
+    string   m_key;
+    int      m_id;
+    int      m_newID;   // OPUPDATE only: the ID the record gets, 0 otherwise
+};
+// a trace is text, one operation per line:
+// nanoseconds, I/R/G/U for insert/remove/getPerson/updateID, ID, new ID,
+// the length of the key and the key bytes, so a key may hold any byte but a newline
+void writeTraceRecord(ostream& out, const TraceRecord& record);
+// reads the lines of a trace into records, false at the first line that is not one
+bool readTrace(istream& in, vector<TraceRecord>& records);
+
+// records the operations of the caches it is attached to, see Cache::setTraceRecorder
+// any number of threads may record at once, their lines do not mix
+class TraceRecorder{
+    public:
+    friend class Grader;
+    friend class Tester;
+    // out has to stay open as long as the recorder is attached to a cache
+    TraceRecorder(ostream& out);
+    void record(op_t op, string_view key, int id, int newID = 0);
+    // number of operations recorded
+    uint64_t count() const;
+    private:
+    ostream&   m_out;       // where the lines go
+    mutable mutex m_lock;   // one line at a time
+    chrono::steady_clock::time_point m_start;   // time 0 of the trace
+    uint64_t   m_count;     // operations recorded
+};
+
 class Cache{
     public:
     friend class Grader;
     friend class Tester;
-    Cache(int size, hash_fn hash, prob_t probing);
+    friend class ShardedCache;
+    Cache(size_t size, hash_fn hash, prob_t probing, hash_t hashing = DEFHASH);
+    Cache(size_t size, hash_view_fn hash, prob_t probing = DEFPOLCY, hash_t hashing = DEFHASH);
     ~Cache();
     // Returns Load factor of the new table
     float lambda() const;
     // Returns the ratio of deleted slots in the new table
     float deletedRatio() const;
     // insert only happens in the new table
-    bool insert(Person person);
+    bool insert(const Person& person);
+    // insert without a Person object
+    bool emplace(string_view key, int id);
     // remove can happen from either table
-    bool remove(Person person);
+    bool remove(const Person& person);
+    bool remove(string_view key, int id);
     // find can happen in either table
-    const Person getPerson(string key, int id) const;
+    const Person getPerson(string_view key, int id) const;
+    // find without a copy, see cache.cpp for how long the view stays valid
+    PersonView getPersonView(string_view key, int id) const;
     // update the information
-    bool updateID(Person person, int ID);
+    bool updateID(const Person& person, int ID);
+    // batch versions, the cache misses of the records of a batch overlap
+    void getPersonBatch(const Person people[], int count, Person results[]) const;
+    int insertBatch(const Person people[], int count, bool results[] = nullptr);
+    int removeBatch(const Person people[], int count, bool results[] = nullptr);
     void changeProbPolicy(prob_t policy);
+    // bounds the rehash work done by a single insert or remove
+    void setTransferBudget(size_t buckets);
+    size_t transferStep() const;
+    // moves old buckets without an insert or remove, e.g. from an idle loop
+    bool drainRehash(size_t buckets);
+    bool isRehashing() const;
+    // lets getPerson run on other threads than the writers, without a lock
+    void setSharedReads(bool shared);
+    // moves the old table on a thread of its own, see cache.cpp for what may run alongside it
+    void startBackgroundRehash();
+    void stopBackgroundRehash();
     void dump() const;
+    // probe lengths, clusters and deleted markers of both tables, in O(capacity)
+    CacheStats analyze() const;
+    // writes what analyze returns as one JSON object or as CSV rows
+    void writeStats(ostream& out, stats_t format) const;
+    static void writeStats(ostream& out, const CacheStats& stats, stats_t format);
+    // sums up the counters, they may be changing meanwhile
+    CacheMetrics metrics() const;
+    void resetMetrics();
+    // bytes of the tables and key pools, in O(1)
+    CacheMemory memoryUsage() const;
+    // latency histograms, see cache.cpp for what is timed
+    void setLatencyTracking(bool on);
+    LatencySummary latency(op_t op) const;
+    // writes the percentiles of every operation as one JSON object or as CSV rows
+    void writeLatency(ostream& out, stats_t format) const;
+    static void writeLatency(ostream& out, const LatencySummary summaries[NUMOPS], stats_t format);
+    void resetLatency();
+    // every operation is written to recorder before it runs, nullptr stops recording,
+    // see cache.cpp
+    void setTraceRecorder(TraceRecorder* recorder);
     private:
-    hash_fn    m_hash;          // hash function
+    // one set of counters on cache lines of its own, updated with relaxed atomics
+    struct alignas(64) MetricStripe{
+        enum counter_t {LOOKUPS, HITS, MISSES, INSERTS, REMOVES, UPDATES, SEARCHES, PROBES,
+                        TOMBSTONEREUSES, LOADREHASHES, DELETEDREHASHES, MIGRATED, MIGRATENANOS,
+                        LOOKUPRETRIES, BACKOFFLOOKUPS, NUMCOUNTERS};
+        atomic<uint64_t> m_count[NUMCOUNTERS];
+    };
+    class OpTimer;  // times one operation, defined in cache.cpp
+
+    hash_view_fn m_viewHash;    // hash function, nullptr if m_hash is used
+    hash_fn    m_hash;          // hash function of the old signature
+    hash_t     m_hashing;       // key-only or composite (key, ID) bucket hash
     prob_t     m_newPolicy;     // stores the change of policy request
 
-    Person**   m_currentTable;  // hash table
-    int        m_currentCap;    // hash table size (capacity)
-    int        m_currentSize;   // current number of entries
+    Slot*      m_currentTable;  // hash table
+    unsigned char* m_currentCtrl; // control bytes of the hash table
+    KeyPool*   m_currentKeys;   // key bytes of the records in the hash table
+    size_t     m_currentCap;    // hash table size (capacity)
+    uint64_t   m_currentMod;    // fastmod multiplier of m_currentCap
+    size_t     m_currentSize;   // current number of entries
                                 // m_currentSize includes deleted entries 
-    int        m_currNumDeleted;// number of deleted entries
+    size_t     m_currNumDeleted;// number of deleted entries
     prob_t     m_currProbing;   // collision handling policy
+    size_t     m_currentKeyBytes;// key bytes of the live records of the hash table
 
-    Person**   m_oldTable;      // hash table
-    int        m_oldCap;        // hash table size (capacity)
-    int        m_oldSize;       // current number of entries
+    Slot*      m_oldTable;      // hash table
+    unsigned char* m_oldCtrl;   // control bytes of the hash table
+    KeyPool*   m_oldKeys;       // key bytes of the records in the hash table
+    size_t     m_oldCap;        // hash table size (capacity)
+    uint64_t   m_oldMod;        // fastmod multiplier of m_oldCap
+    size_t     m_oldSize;       // current number of entries
                                 // m_oldSize includes deleted entries
-    int        m_oldNumDeleted; // number of deleted entries
+    size_t     m_oldNumDeleted; // number of deleted entries
     prob_t     m_oldProbing;    // collision handling policy
 
-    int        m_transferIndex; // this can be used as a temporary place holder
+    size_t     m_transferIndex; // this can be used as a temporary place holder
                                 // during incremental transfer to scanning the table
+    size_t     m_transferBudget;// configured old buckets moved per insert/remove
+    size_t     m_transferStep;  // old buckets moved per insert/remove in this rehash
+    bool       m_handoffKeys;   // the running rehash moves key pointers, not key bytes
+
+    thread     m_migrator;      // background migrator thread
+    atomic<bool> m_background;  // true while the migrator thread runs, read by lock-free lookups
+    bool       m_stopMigrator;  // tells the migrator to exit, guarded by m_writeLock
+    mutable recursive_mutex m_writeLock;    // taken by writers and the migrator
+    condition_variable_any  m_rehashStarted;// wakes the migrator when a rehash starts
+    bool       m_sharedReads;   // lookups may run on other threads than the writers
+    atomic<uint64_t> m_seq;     // odd while a writer changes the tables
+    int        m_writeDepth;    // nested write sections, only the outermost one moves m_seq
+    RetiredTable* m_retired;    // retired tables lookups may still be reading
+#ifndef CACHE_NO_METRICS
+    mutable MetricStripe m_metrics[METRICSTRIPES];  // counters, a thread uses one stripe
+#endif
+    bool       m_trackLatency;  // operations are timed into m_latency
+    LatencyHistogram* m_latency;// NUMOPS histograms, nullptr until tracking is first turned on
+    TraceRecorder* m_trace;     // operations are recorded here, nullptr when not recording
 
     //private helper functions
-    bool isPrime(int number);
-    int findNextPrime(int current);
+    int ladderIndexFor(size_t size);
 
     /******************************************
     * Private function declarations go here! *
     ******************************************/
+    void countMetric(MetricStripe::counter_t counter, uint64_t amount = 1) const;
+    void traceOp(op_t op, string_view key, int id, int newID = 0) const;
     void incrementalTransfer();
-    int probeIndex(int baseIndex, int i, prob_t policy, int cap, hash_fn hash, const string& key) const;
+    void transferBuckets(size_t buckets);
+    void migrate();
+    unique_lock<recursive_mutex> writeLock() const;
+    // the public operations with the hash of the key computed by the caller
+    bool emplaceKeyed(string_view key, int id, unsigned int keyHash);
+    bool removeKeyed(string_view key, int id, unsigned int keyHash);
+    Person getPersonKeyed(string_view key, int ID, unsigned int keyHash) const;
+    PersonView getPersonViewKeyed(string_view key, int ID, unsigned int keyHash) const;
+    bool updateIDKeyed(const Person& person, int ID, unsigned int keyHash);
+    const Slot* findSlot(unsigned int hash, string_view key, int ID) const;
+    Person lookup(unsigned int hash, string_view key, int ID) const;
+    bool insertHashed(string_view key, int id, unsigned int hash);
+    bool removeHashed(string_view key, int id, unsigned int hash);
+    bool moveRecord(Cache& dest, const Person& person, int ID, unsigned int keyHash);
+    void prefetchHome(unsigned int hash) const;
+    bool concurrentFind(unsigned int hash, string_view key, int ID) const;
+    void beginWrite();
+    void endWrite();
+    bool seqUnchanged(uint64_t seq) const;
+    void retireTable(Slot* table, unsigned char* ctrl, KeyPool* keys);
+    void reclaimTables(bool all);
+    static void writeSlot(Slot& slot, const Slot& value);
+    static void setSlotID(Slot& slot, int id);
+    bool slotMatches(const Slot& slot, unsigned int hash, string_view key, int id, uint64_t seq) const;
+    unsigned int bucketHash(string_view key, int id) const;
+    unsigned int keyHash(string_view key) const;
+    unsigned int combineID(unsigned int keyHash, int id) const;
+    Slot* allocTable(size_t cap);
+    unsigned char* allocCtrl(size_t cap);
+    static void setCtrl(unsigned char* ctrl, size_t cap, size_t index, unsigned char value);
+    bool insertRecord(const char* key, unsigned int len, unsigned int hash, int id);
+    uint64_t storeKey(size_t index, const char* key, unsigned int len, bool handoff);
+    void placeRecord(size_t index, const char* key, unsigned int len, unsigned int hash, int id,
+                     bool handoff = false);
+    bool placeRobinHood(size_t start, size_t dist, const char* key, unsigned int len,
+                        unsigned int hash, int id, bool handoff = false);
+    void backwardShift(size_t index);
+    size_t findRecord(const Slot* table, const unsigned char* ctrl, size_t cap, uint64_t mod, prob_t policy,
+                      unsigned int hash, string_view key, int id, uint64_t seq = NOSEQ) const;
+    bool findInsertSlot(unsigned int hash, string_view key, int id, size_t& index, size_t& dist) const;
+    size_t findFree(const unsigned char* ctrl, size_t cap, uint64_t mod, prob_t policy, unsigned int hash) const;
+    float maxLoad(prob_t policy) const;
+    void analyzeTable(const Slot* table, const unsigned char* ctrl, size_t cap, uint64_t mod, prob_t policy,
+                      TableStats& stats) const;
     void startRehash();
     
 };
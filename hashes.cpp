@@ -0,0 +1,262 @@
+// CMSC 341 - Fall 25 - Project 4
+// student: Andrew Soth
+// professor: Kartchner
+
+#include "hashes.h"
+#include <cstring>
+#if defined(__SSE4_2__) || defined(__AES__)
+#include <immintrin.h>
+#endif
+
+// reads 8, 4 or 1 to 3 bytes of a key as a little-endian number
+// memcpy compiles to a single unaligned load
+static inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint64_t read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t read3(const unsigned char* p, size_t k) {
+    return (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[k >> 1]) << 8) | p[k - 1];
+}
+
+// the tables only take 32 bits, the halves of a 64-bit hash are folded together
+static inline unsigned int fold64(uint64_t h) {
+    return static_cast<unsigned int>(h ^ (h >> 32));
+}
+
+unsigned int djbHash(string_view key) {
+    unsigned int val = 0;
+    const unsigned int thirtyThree = 33;
+    for (size_t i = 0; i < key.length(); i++)
+        val = val * thirtyThree + key[i];
+    return val;
+}
+
+/*************************************
+*************** wyhash ***************
+*************************************/
+
+// constants of the final version 4 of wyhash (Wang Yi, public domain)
+static const uint64_t WYSECRET[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+static const uint64_t WYSEED = 0x2d358dccaa6c78a5ull;
+
+// the 128-bit product of a and b, low half in a and high half in b
+static inline void wyMultiply(uint64_t& a, uint64_t& b) {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 r = a;
+    r *= b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+#else
+    // schoolbook multiplication of the 32-bit halves
+    uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a), lb = static_cast<uint32_t>(b);
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    a = lo;
+    b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t wyMix(uint64_t a, uint64_t b) {
+    wyMultiply(a, b);
+    return a ^ b;
+}
+
+static uint64_t wyHash64(const unsigned char* p, size_t len, uint64_t seed) {
+    seed ^= wyMix(seed ^ WYSECRET[0], WYSECRET[1]);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            // two overlapping reads cover 4 to 16 bytes
+            a = (read32(p) << 32) | read32(p + ((len >> 3) << 2));
+            b = (read32(p + len - 4) << 32) | read32(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = read3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            // three independent lanes
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wyMix(read64(p) ^ WYSECRET[1], read64(p + 8) ^ seed);
+                see1 = wyMix(read64(p + 16) ^ WYSECRET[2], read64(p + 24) ^ see1);
+                see2 = wyMix(read64(p + 32) ^ WYSECRET[3], read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wyMix(read64(p) ^ WYSECRET[1], read64(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        // the last 16 bytes, overlapping what came before
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+    a ^= WYSECRET[1];
+    b ^= seed;
+    wyMultiply(a, b);
+    return wyMix(a ^ WYSECRET[0] ^ len, b ^ WYSECRET[1]);
+}
+
+unsigned int wyHash(string_view key) {
+    return fold64(wyHash64(reinterpret_cast<const unsigned char*>(key.data()), key.length(), WYSEED));
+}
+
+/*************************************
+*************** CRC32C ***************
+*************************************/
+
+// reflected Castagnoli polynomial
+const uint32_t CRC32CPOLY = 0x82F63B78u;
+
+// byte table of the portable version, computed at compile time
+struct Crc32cTable {
+    uint32_t m_entry[256];
+    constexpr Crc32cTable() : m_entry() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; k++) {
+                crc = (crc & 1) ? (crc >> 1) ^ CRC32CPOLY : crc >> 1;
+            }
+            m_entry[i] = crc;
+        }
+    }
+};
+static constexpr Crc32cTable CRC32CTABLE;
+
+unsigned int crc32cHash(string_view key) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(key.data());
+    size_t len = key.length();
+    uint32_t crc = 0xFFFFFFFFu;
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t chunk;
+        memcpy(&chunk, p, 8);
+        crc64 = _mm_crc32_u64(crc64, chunk);
+        p += 8;
+        len -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (len > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+#else
+    while (len > 0) {
+        crc = CRC32CTABLE.m_entry[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+#endif
+    return ~crc;
+}
+
+bool crc32cHardware() {
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*************************************
+*************** AES mix **************
+*************************************/
+
+#if defined(__AES__) && defined(__x86_64__)
+// one AES round per 16 bytes of key, the round keys are the wyhash constants
+// a single round only mixes within 4-byte columns, the three closing rounds
+// spread every input bit over the whole state
+unsigned int aesHash(string_view key) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(key.data());
+    size_t len = key.length();
+    const __m128i roundKey = _mm_set_epi64x(static_cast<long long>(WYSECRET[0]),
+                                            static_cast<long long>(WYSECRET[1]));
+    __m128i state = _mm_set_epi64x(static_cast<long long>(len), static_cast<long long>(WYSEED));
+    while (len >= 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        state = _mm_aesenc_si128(_mm_xor_si128(state, block), roundKey);
+        p += 16;
+        len -= 16;
+    }
+    if (len > 0) {
+        // the tail is read with overlapping reads as in wyhash, no byte past the key is read
+        uint64_t a, b;
+        if (len >= 8) {
+            a = read64(p);
+            b = read64(p + len - 8);
+        } else if (len >= 4) {
+            a = read32(p);
+            b = read32(p + len - 4);
+        } else {
+            a = read3(p, len);
+            b = 0;
+        }
+        __m128i block = _mm_set_epi64x(static_cast<long long>(b), static_cast<long long>(a));
+        state = _mm_aesenc_si128(_mm_xor_si128(state, block), roundKey);
+    }
+    const __m128i finalKey = _mm_set_epi64x(static_cast<long long>(WYSECRET[2]),
+                                            static_cast<long long>(WYSECRET[3]));
+    state = _mm_aesenc_si128(state, finalKey);
+    state = _mm_aesenc_si128(state, roundKey);
+    state = _mm_aesenc_si128(state, finalKey);
+    uint64_t low = static_cast<uint64_t>(_mm_cvtsi128_si64(state));
+    uint64_t high = static_cast<uint64_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(state, state)));
+    return fold64(low ^ high);
+}
+
+bool aesHardware() {
+    return true;
+}
+#else
+// portable fallback
+unsigned int aesHash(string_view key) {
+    return wyHash(key);
+}
+
+bool aesHardware() {
+    return false;
+}
+#endif
+
+const HashFunction HASHFUNCTIONS[] = {
+    {"djb", djbHash},
+    {"wyhash", wyHash},
+    {"crc32c", crc32cHash},
+    {"aes", aesHash}
+};
+const int NUMHASHFUNCTIONS = sizeof(HASHFUNCTIONS) / sizeof(HASHFUNCTIONS[0]);
+
+hash_view_fn findHashFunction(string_view name) {
+    for (int i = 0; i < NUMHASHFUNCTIONS; i++) {
+        if (name == HASHFUNCTIONS[i].m_name) {
+            return HASHFUNCTIONS[i].m_hash;
+        }
+    }
+    return nullptr;
+}
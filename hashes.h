@@ -0,0 +1,34 @@
+// CMSC 341 - Fall 25 - Project 4
+#ifndef HASHES_H
+#define HASHES_H
+#include "cache.h"
+
+// ready-made hash functions for Cache and ShardedCache, all of them read the key
+// in place (hash_view_fn), so no string is built for a call
+// the SIMD versions are picked at compile time like the SWISS group matching,
+// build with -msse4.2 -maes (or -march=native) to get them
+
+// the classic val*33 + c loop, one byte at a time, kept as the baseline
+unsigned int djbHash(string_view key);
+// wyhash: 8 or 16 bytes per step, mixed with 64x64->128 bit multiplications
+unsigned int wyHash(string_view key);
+// CRC32C (Castagnoli), with the SSE4.2 crc32 instruction 8 bytes per step,
+// otherwise a byte table, both give the same values
+unsigned int crc32cHash(string_view key);
+// 16 bytes per AES round with AES-NI, without it this is wyHash,
+// so its values depend on the build
+unsigned int aesHash(string_view key);
+
+// the hash functions above by name, for picking one from a command line
+struct HashFunction {
+    const char*  m_name;
+    hash_view_fn m_hash;
+};
+extern const HashFunction HASHFUNCTIONS[];
+extern const int NUMHASHFUNCTIONS;
+// returns the hash function called name, nullptr if there is none
+hash_view_fn findHashFunction(string_view name);
+// true when the function runs on the SIMD instruction it is built around
+bool crc32cHardware();
+bool aesHardware();
+#endif
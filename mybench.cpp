@@ -0,0 +1,433 @@
+// CMSC 341 - Fall 2025 - Project 4
+// mybench.cpp - Benchmark suite for Cache: sweeps the table size, load factor, collision
+// policy, hash function, key lengths, hit ratio and read/write mix one at a time around a
+// base case, and times tables that grow through their rehashes
+// build: g++ -std=c++17 -O2 -march=native -pthread cache.cpp hashes.cpp mybench.cpp -o mybench
+// usage: ./mybench [-q] [-f filter] [-o results.csv] [-c baseline.csv] [-t percent]
+//   -q  quick run, smaller tables and fewer operations
+//   -f  runs only the cases whose name contains filter
+//   -o  writes the results as CSV, one row per case
+//   -c  compares ns/op and probes/op with the CSV of an earlier run, exits with 1 on a regression
+//   -t  percent of ns/op above the baseline taken as a regression, 10 if not given
+#include "hashes.h"
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+using namespace std;
+
+const int REPEATS = 3;              // timed runs of a case, the fastest one counts
+const int BASERECORDS = 100000;     // records in the table of the base case
+const int QUICKRECORDS = 20000;
+const int BASEOPS = 1000000;        // timed operations of a case
+const int QUICKOPS = 200000;
+const double REGRESSION = 0.10;     // default ns/op this much above the baseline is a regression
+const double MOREPROBES = 0.01;     // probes/op do not depend on timing, 1% more is a regression
+const char* const POLICYNAMES[] = {"QUADRATIC", "DOUBLEHASH", "LINEAR", "SWISS", "ROBINHOOD"};
+
+// lengths of the generated keys
+struct KeyLengths {
+    const char* m_name;
+    int         m_min;
+    int         m_max;
+};
+const KeyLengths KEYLENGTHS[] = {{"short", 8, 16}, {"medium", 16, 48}, {"long", 64, 128}};
+
+// one benchmark case
+struct BenchCase {
+    string m_name;
+    bool   m_rehash;    // grows a table from MINPRIME instead of running the operation mix
+    int    m_records;   // records in the table before the timed run
+    double m_load;      // load factor the table is sized for
+    prob_t m_policy;
+    int    m_hash;      // index into HASHFUNCTIONS
+    int    m_keys;      // index into KEYLENGTHS
+    double m_hit;       // fraction of the lookups that find their record
+    int    m_reads;     // percent of the operations that are lookups, the rest inserts and removes
+};
+
+// what a case measured
+struct BenchResult {
+    bool     m_ok;          // false if a lookup found the wrong thing
+    int      m_ops;         // operations of one run
+    double   m_opsPerSec;
+    double   m_nsPerOp;
+    double   m_probesPerOp; // buckets (SWISS: groups) read per operation, 0 without metrics
+    double   m_load;        // load factor of the table before the run
+    uint64_t m_p99;         // insert latencies of a rehash case, 0 otherwise
+    uint64_t m_p999;
+    uint64_t m_max;
+};
+
+// one operation of the mix, the index is into the key set of the operation
+struct BenchOp {
+    enum type_t {HIT, MISS, INSERT, REMOVE};
+    type_t m_type;
+    int  m_index;
+};
+
+// small generator, cheaper than mt19937
+class XorShift {
+public:
+    XorShift(unsigned long long seed) : m_state(seed * 0x9e3779b97f4a7c15ULL + 1) {}
+    unsigned int next() {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return static_cast<unsigned int>(m_state >> 32);
+    }
+private:
+    unsigned long long m_state;
+};
+
+int recordID(int i) {
+    return MINID + i % (MAXID - MINID);
+}
+
+// count distinct keys: the tag and the number of the key, then random letters up to
+// a length between the bounds of lengths, the tag keeps the key sets apart
+vector<string> makeKeys(char tag, int count, const KeyLengths& lengths, unsigned long long seed) {
+    vector<string> keys;
+    keys.reserve(count);
+    XorShift rnd(seed);
+    for (int i = 0; i < count; i++) {
+        string key = tag + to_string(i);
+        int len = lengths.m_min + static_cast<int>(rnd.next() % (lengths.m_max - lengths.m_min + 1));
+        while (static_cast<int>(key.length()) < len) {
+            key += static_cast<char>('a' + rnd.next() % 26);
+        }
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+// returns the nanoseconds since start
+double elapsedNanos(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+}
+
+// runs the operation mix of a case on a table holding c.m_records records
+// inserts and removes toggle the records of a churn set, half of which is in the
+// table at the start, so the load factor stays where it was
+BenchResult runMix(const BenchCase& c, int ops) {
+    const KeyLengths& lengths = KEYLENGTHS[c.m_keys];
+    int churn = c.m_records / 20 + 1;
+    vector<string> records = makeKeys('r', c.m_records, lengths, 1);
+    vector<string> misses = makeKeys('m', c.m_records, lengths, 2);
+    vector<string> churnKeys = makeKeys('c', churn, lengths, 3);
+
+    // the operations are drawn before the timed run
+    vector<BenchOp> mix(ops);
+    vector<bool> present(churn);
+    for (int i = 0; i < churn; i++) {
+        present[i] = (i % 2 == 0);
+    }
+    XorShift rnd(4);
+    size_t hits = 0;
+    for (int i = 0; i < ops; i++) {
+        unsigned int r = rnd.next();
+        if (static_cast<int>(r % 100) < c.m_reads) {
+            bool hit = (rnd.next() % 10000) < static_cast<unsigned int>(c.m_hit * 10000);
+            mix[i].m_type = hit ? BenchOp::HIT : BenchOp::MISS;
+            mix[i].m_index = static_cast<int>(rnd.next() % c.m_records);
+            hits += hit ? 1 : 0;
+        } else {
+            int k = static_cast<int>(rnd.next() % churn);
+            mix[i].m_type = present[k] ? BenchOp::REMOVE : BenchOp::INSERT;
+            mix[i].m_index = k;
+            present[k] = !present[k];
+        }
+    }
+
+    BenchResult result = BenchResult();
+    result.m_ok = true;
+    result.m_ops = ops;
+    double best = 1e300;
+    size_t capacity = static_cast<size_t>((c.m_records + churn / 2) / c.m_load);
+    for (int rep = 0; rep < REPEATS; rep++) {
+        // a fresh table for every run, the writes of the last one changed it
+        Cache cache(capacity, HASHFUNCTIONS[c.m_hash].m_hash, c.m_policy);
+        for (int i = 0; i < c.m_records; i++) {
+            cache.emplace(records[i], recordID(i));
+        }
+        for (int i = 0; i < churn; i += 2) {
+            cache.emplace(churnKeys[i], recordID(i));
+        }
+        result.m_load = cache.lambda();
+        cache.resetMetrics();
+
+        size_t found = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int i = 0; i < ops; i++) {
+            const BenchOp& op = mix[i];
+            switch (op.m_type) {
+            case BenchOp::HIT:
+                found += cache.getPersonView(records[op.m_index], recordID(op.m_index)).getUsed();
+                break;
+            case BenchOp::MISS:
+                found += cache.getPersonView(misses[op.m_index], recordID(op.m_index)).getUsed();
+                break;
+            case BenchOp::INSERT:
+                cache.emplace(churnKeys[op.m_index], recordID(op.m_index));
+                break;
+            case BenchOp::REMOVE:
+                cache.remove(churnKeys[op.m_index], recordID(op.m_index));
+                break;
+            }
+        }
+        double nanos = elapsedNanos(start);
+        if (found != hits) {
+            result.m_ok = false;
+        }
+        if (nanos < best) {
+            best = nanos;
+        }
+        result.m_probesPerOp = static_cast<double>(cache.metrics().m_probes) / ops;
+    }
+    result.m_nsPerOp = best / ops;
+    result.m_opsPerSec = 1e9 / result.m_nsPerOp;
+    return result;
+}
+
+// inserts c.m_records records into a table that starts at MINPRIME buckets, so it goes
+// through every rehash on the way, the insert latencies show the rehash spikes
+BenchResult runRehash(const BenchCase& c) {
+    vector<string> records = makeKeys('r', c.m_records, KEYLENGTHS[c.m_keys], 1);
+    BenchResult result = BenchResult();
+    result.m_ok = true;
+    result.m_ops = c.m_records;
+    double best = 1e300;
+    for (int rep = 0; rep < REPEATS; rep++) {
+        Cache cache(MINPRIME, HASHFUNCTIONS[c.m_hash].m_hash, c.m_policy);
+        cache.setLatencyTracking(true);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int i = 0; i < c.m_records; i++) {
+            if (!cache.emplace(records[i], recordID(i))) {
+                result.m_ok = false;
+            }
+        }
+        double nanos = elapsedNanos(start);
+        if (nanos < best) {
+            // the latencies of the fastest run go with its time
+            best = nanos;
+            LatencySummary inserts = cache.latency(OPINSERT);
+            result.m_p99 = inserts.m_p99;
+            result.m_p999 = inserts.m_p999;
+            result.m_max = inserts.m_max;
+        }
+        result.m_load = cache.lambda();
+        result.m_probesPerOp = static_cast<double>(cache.metrics().m_probes) / c.m_records;
+    }
+    result.m_nsPerOp = best / c.m_records;
+    result.m_opsPerSec = 1e9 / result.m_nsPerOp;
+    return result;
+}
+
+// the base case and the sweeps around it, each sweep changes one setting
+vector<BenchCase> makeCases(bool quick) {
+    int hashIndex = 0;
+    for (int h = 0; h < NUMHASHFUNCTIONS; h++) {
+        if (HASHFUNCTIONS[h].m_hash == wyHash) {
+            hashIndex = h;
+        }
+    }
+    BenchCase base = {"base", false, quick ? QUICKRECORDS : BASERECORDS, 0.35, QUADRATIC,
+                      hashIndex, 0, 0.9, 90};
+    vector<BenchCase> cases;
+    cases.push_back(base);
+
+    vector<int> sizes = {1000, 10000};
+    if (!quick) {
+        sizes.push_back(1000000);
+    }
+    for (int size : sizes) {
+        BenchCase c = base;
+        c.m_records = size;
+        c.m_name = "size=" + to_string(size);
+        cases.push_back(c);
+    }
+    for (double load : {0.1, 0.2, 0.45}) {
+        BenchCase c = base;
+        c.m_load = load;
+        ostringstream name;
+        name << "load=" << load;
+        c.m_name = name.str();
+        cases.push_back(c);
+    }
+    for (prob_t policy : {DOUBLEHASH, LINEAR, SWISS, ROBINHOOD}) {
+        BenchCase c = base;
+        c.m_policy = policy;
+        c.m_name = string("policy=") + POLICYNAMES[policy];
+        cases.push_back(c);
+    }
+    for (int h = 0; h < NUMHASHFUNCTIONS; h++) {
+        if (h != base.m_hash) {
+            BenchCase c = base;
+            c.m_hash = h;
+            c.m_name = string("hash=") + HASHFUNCTIONS[h].m_name;
+            cases.push_back(c);
+        }
+    }
+    for (int k = 1; k < 3; k++) {
+        BenchCase c = base;
+        c.m_keys = k;
+        c.m_name = string("keys=") + KEYLENGTHS[k].m_name;
+        cases.push_back(c);
+    }
+    for (double hit : {1.0, 0.5, 0.0}) {
+        BenchCase c = base;
+        c.m_hit = hit;
+        ostringstream name;
+        name << "hit=" << hit;
+        c.m_name = name.str();
+        cases.push_back(c);
+    }
+    for (int reads : {100, 50, 10}) {
+        BenchCase c = base;
+        c.m_reads = reads;
+        c.m_name = "reads=" + to_string(reads);
+        cases.push_back(c);
+    }
+    for (prob_t policy : {QUADRATIC, DOUBLEHASH, LINEAR, SWISS, ROBINHOOD}) {
+        BenchCase c = base;
+        c.m_rehash = true;
+        c.m_policy = policy;
+        c.m_name = string("rehash/") + POLICYNAMES[policy];
+        cases.push_back(c);
+    }
+    return cases;
+}
+
+const char* const CSVHEADER = "case,records,load,policy,hash,keys,hit,reads,ops,"
+                              "ops_per_sec,ns_per_op,probes_per_op,p99_ns,p999_ns,max_ns";
+
+void writeRow(ostream& out, const BenchCase& c, const BenchResult& r) {
+    out << c.m_name << "," << c.m_records << "," << r.m_load << "," << POLICYNAMES[c.m_policy] << ","
+        << HASHFUNCTIONS[c.m_hash].m_name << "," << KEYLENGTHS[c.m_keys].m_name << ","
+        << c.m_hit << "," << c.m_reads << "," << r.m_ops << ","
+        << static_cast<long long>(r.m_opsPerSec) << "," << r.m_nsPerOp << "," << r.m_probesPerOp << ","
+        << r.m_p99 << "," << r.m_p999 << "," << r.m_max << endl;
+}
+
+// reads the case names, ns/op and probes/op of an earlier CSV, false if it cannot be read
+bool readBaseline(const char* file, vector<string>& names, vector<double>& nsPerOp,
+                  vector<double>& probesPerOp) {
+    ifstream in(file);
+    string line;
+    if (!getline(in, line) || line != CSVHEADER) {
+        return false;
+    }
+    while (getline(in, line)) {
+        vector<string> fields;
+        stringstream row(line);
+        string field;
+        while (getline(row, field, ',')) {
+            fields.push_back(field);
+        }
+        if (fields.size() >= 12) {
+            names.push_back(fields[0]);
+            nsPerOp.push_back(atof(fields[10].c_str()));
+            probesPerOp.push_back(atof(fields[11].c_str()));
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    bool quick = false;
+    const char* filter = nullptr;
+    const char* outFile = nullptr;
+    const char* baselineFile = nullptr;
+    double threshold = REGRESSION;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-q") == 0) {
+            quick = true;
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outFile = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            baselineFile = argv[++i];
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]) / 100;
+        } else {
+            cout << "usage: " << argv[0] << " [-q] [-f filter] [-o results.csv] [-c baseline.csv] [-t percent]" << endl;
+            return 1;
+        }
+    }
+
+    vector<string> baseNames;
+    vector<double> baseNs;
+    vector<double> baseProbes;
+    if (baselineFile != nullptr && !readBaseline(baselineFile, baseNames, baseNs, baseProbes)) {
+        cout << "cannot read the baseline " << baselineFile << endl;
+        return 1;
+    }
+    ofstream out;
+    if (outFile != nullptr) {
+        out.open(outFile);
+        if (!out) {
+            cout << "cannot write " << outFile << endl;
+            return 1;
+        }
+        out << CSVHEADER << endl;
+    }
+
+    int ops = quick ? QUICKOPS : BASEOPS;
+    if (!Cache(MINPRIME, wyHash).metrics().m_enabled) {
+        cout << "built with CACHE_NO_METRICS, probes/op are 0" << endl;
+    }
+    cout << left << setw(20) << "case" << setw(12) << "ops/s" << setw(10) << "ns/op" << setw(11) << "probes/op"
+         << setw(8) << "load" << setw(9) << "p99 ns" << setw(9) << "p999 ns" << "vs baseline" << endl;
+    bool ok = true;
+    bool regression = false;
+    vector<BenchCase> cases = makeCases(quick);
+    // one untimed run first, so the first case does not pay for the cold start
+    runMix(cases[0], ops / 10);
+    for (size_t i = 0; i < cases.size(); i++) {
+        const BenchCase& c = cases[i];
+        if (filter != nullptr && c.m_name.find(filter) == string::npos) {
+            continue;
+        }
+        BenchResult r = c.m_rehash ? runRehash(c) : runMix(c, ops);
+        if (!r.m_ok) {
+            ok = false;
+        }
+        cout << setw(20) << c.m_name << setw(12) << static_cast<long long>(r.m_opsPerSec)
+             << setw(10) << setprecision(4) << r.m_nsPerOp << setw(11) << setprecision(3) << r.m_probesPerOp
+             << setw(8) << setprecision(3) << r.m_load;
+        if (c.m_rehash) {
+            cout << setw(9) << r.m_p99 << setw(9) << r.m_p999;
+        } else {
+            cout << setw(9) << "-" << setw(9) << "-";
+        }
+        for (size_t b = 0; b < baseNames.size(); b++) {
+            if (baseNames[b] == c.m_name && baseNs[b] > 0) {
+                double change = r.m_nsPerOp / baseNs[b] - 1.0;
+                cout << (change >= 0 ? "+" : "") << static_cast<int>(change * 100) << "%";
+                if (change > threshold) {
+                    cout << " SLOWER";
+                    regression = true;
+                }
+                if (r.m_probesPerOp > baseProbes[b] * (1 + MOREPROBES)) {
+                    cout << " MORE PROBES";
+                    regression = true;
+                }
+            }
+        }
+        cout << (r.m_ok ? "" : " FAILED") << endl;
+        if (outFile != nullptr) {
+            writeRow(out, c, r);
+        }
+    }
+
+    cout << endl << (ok ? "All lookups found what they should." : "FAILED: lookups went wrong.") << endl;
+    if (regression) {
+        cout << "Some cases are more than " << static_cast<int>(threshold * 100)
+             << "% slower than the baseline or probe more." << endl;
+    }
+    return (ok && !regression) ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+// CMSC 341 - Fall 2025 - Project 4
+// myhashbench.cpp - Compares the hash functions of hashes.h on a few key sets
+// build: g++ -std=c++17 -O2 -march=native -pthread cache.cpp hashes.cpp myhashbench.cpp -o myhashbench
+// usage: ./myhashbench [keys per set]
+#include "hashes.h"
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+using namespace std;
+
+const int DEFKEYS = 200000;     // keys in each key set
+const int REPEATS = 5;          // hash timing runs, the fastest one counts
+
+// small generator for the random key sets
+class XorShift {
+public:
+    XorShift(unsigned long long seed) : m_state(seed * 0x9e3779b97f4a7c15ULL + 1) {}
+    unsigned int next() {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return static_cast<unsigned int>(m_state >> 32);
+    }
+private:
+    unsigned long long m_state;
+};
+
+// short keys that only differ in their last digits, where djb clusters
+vector<string> sequentialKeys(int count) {
+    vector<string> keys;
+    for (int i = 0; i < count; i++) {
+        keys.push_back("user" + to_string(i));
+    }
+    return keys;
+}
+
+// random letters, 8 to 32 of them
+vector<string> randomKeys(int count) {
+    vector<string> keys;
+    XorShift rnd(7);
+    for (int i = 0; i < count; i++) {
+        int len = 8 + rnd.next() % 25;
+        string key;
+        for (int k = 0; k < len; k++) {
+            key += static_cast<char>('a' + rnd.next() % 26);
+        }
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+// url-like keys of 60 to 80 bytes with a long common prefix
+vector<string> longKeys(int count) {
+    vector<string> keys;
+    for (int i = 0; i < count; i++) {
+        keys.push_back("https://www.example.com/catalog/products/category-" + to_string(i % 97) +
+                       "/item?id=" + to_string(i * 7919));
+    }
+    return keys;
+}
+
+// returns the nanoseconds per key of hashing every key of the set
+double hashTime(hash_view_fn hash, const vector<string>& keys) {
+    double best = 1e30;
+    unsigned int sink = 0;
+    for (int r = 0; r < REPEATS; r++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (size_t i = 0; i < keys.size(); i++) {
+            sink += hash(keys[i]);
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (seconds < best) {
+            best = seconds;
+        }
+    }
+    // keeps the loop from being optimized away
+    if (sink == 1) {
+        cout << "";
+    }
+    return best * 1e9 / keys.size();
+}
+
+// returns the nanoseconds per getPersonView of a LINEAR cache holding the keys at a
+// load of about 0.5, stats gets the probe lengths and clusters of the cache
+double lookupTime(hash_view_fn hash, const vector<string>& keys, CacheStats& stats) {
+    Cache cache(keys.size() * 2, hash, LINEAR);
+    for (size_t i = 0; i < keys.size(); i++) {
+        cache.emplace(keys[i], MINID + static_cast<int>(i % (MAXID - MINID)));
+    }
+    stats = cache.analyze();
+    // the keys are looked up in a random order, in insertion order a hash that keeps
+    // similar keys in neighbouring buckets would look better than it is
+    vector<size_t> order(keys.size());
+    XorShift rnd(11);
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    for (size_t i = order.size() - 1; i > 0; i--) {
+        swap(order[i], order[rnd.next() % (i + 1)]);
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    size_t found = 0;
+    for (size_t j = 0; j < order.size(); j++) {
+        size_t i = order[j];
+        found += cache.getPersonView(keys[i], MINID + static_cast<int>(i % (MAXID - MINID))).getUsed();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (found != keys.size()) {
+        return -1.0;
+    }
+    return seconds * 1e9 / keys.size();
+}
+
+int main(int argc, char* argv[]) {
+    int count = DEFKEYS;
+    if (argc > 1) {
+        count = atoi(argv[1]);
+    }
+    if (count < 1) {
+        count = 1;
+    }
+
+    cout << "crc32c: " << (crc32cHardware() ? "SSE4.2" : "portable table")
+         << ", aes: " << (aesHardware() ? "AES-NI" : "portable (wyhash)") << endl;
+
+    const char* setNames[] = {"sequential", "random", "long"};
+    vector<string> sets[] = {sequentialKeys(count), randomKeys(count), longKeys(count)};
+    bool result = true;
+    for (int s = 0; s < 3; s++) {
+        cout << endl << setNames[s] << " keys (" << count << ")" << endl;
+        cout << "hash\tns/hash\tavg probe\tmax probe\tmax cluster\tns/lookup" << endl;
+        for (int h = 0; h < NUMHASHFUNCTIONS; h++) {
+            CacheStats stats;
+            double lookup = lookupTime(HASHFUNCTIONS[h].m_hash, sets[s], stats);
+            if (lookup < 0) {
+                result = false;
+            }
+            cout << HASHFUNCTIONS[h].m_name << "\t" << hashTime(HASHFUNCTIONS[h].m_hash, sets[s])
+                 << "\t" << stats.m_current.m_averageProbe << "\t\t" << stats.m_current.m_maxProbe
+                 << "\t\t" << stats.m_current.m_maxCluster << "\t\t" << lookup << endl;
+        }
+    }
+    cout << endl << (result ? "All lookups found their records." : "FAILED: lookups missed records.") << endl;
+    return result ? 0 : 1;
+}
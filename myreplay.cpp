@@ -0,0 +1,306 @@
+// CMSC 341 - Fall 2025 - Project 4
+// myreplay.cpp - Replays a recorded trace of operations against a Cache
+// build: g++ -std=c++17 -O2 -march=native -pthread cache.cpp hashes.cpp myreplay.cpp -o myreplay
+// usage: ./myreplay <trace> [-r] [-b] [-s size] [-p policy] [-h hash]
+//   -r  keeps the times of the trace instead of running at full speed
+//   -b  moves rehashes on the background migrator thread
+//   -s  initial capacity of the cache, MINPRIME if not given
+//   -p  collision policy: QUADRATIC, DOUBLEHASH, LINEAR, SWISS or ROBINHOOD
+//   -h  hash function of hashes.h, wyhash if not given
+// or:  ./myreplay -g <trace> [keys] [operations]
+//   writes a synthetic trace: Zipf-skewed lookups, bursts of writes, and records
+//   that are removed and inserted again soon after, recorded from a Cache running it
+// traces are recorded with Cache::setTraceRecorder, see cache.h for their format
+#include "hashes.h"
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+using namespace std;
+
+const int DEFKEYS = 100000;         // keys of a generated trace
+const int DEFOPERATIONS = 1000000;  // operations of a generated trace
+const double ZIPFSKEW = 0.99;       // exponent of the key popularity
+const int BURSTEVERY = 50000;       // operations between the starts of write bursts
+const int BURSTLENGTH = 5000;       // operations of a burst
+const uint64_t GAPNANOS = 1000;     // average time between operations outside a burst
+const uint64_t BURSTGAPNANOS = 100; // and inside one
+const int MAXREINSERT = 200;        // a removed record comes back within this many operations
+const uint64_t SPINNANOS = 50000;   // gaps shorter than this are waited out without sleeping
+const char* const POLICYNAMES[] = {"QUADRATIC", "DOUBLEHASH", "LINEAR", "SWISS", "ROBINHOOD"};
+const char* const OPNAMES[] = {"insert", "remove", "lookup", "update", "migration"};
+
+// small generator, cheaper than mt19937
+class XorShift {
+public:
+    XorShift(unsigned long long seed) : m_state(seed * 0x9e3779b97f4a7c15ULL + 1) {}
+    unsigned int next() {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return static_cast<unsigned int>(m_state >> 32);
+    }
+    // uniform in [0, 1)
+    double uniform() {
+        return next() / 4294967296.0;
+    }
+private:
+    unsigned long long m_state;
+};
+
+// draws key ranks 0 to count-1, rank k with a weight of 1/(k+1)^ZIPFSKEW
+class Zipf {
+public:
+    Zipf(int count) : m_cdf(count) {
+        double sum = 0.0;
+        for (int k = 0; k < count; k++) {
+            sum += 1.0 / pow(k + 1.0, ZIPFSKEW);
+            m_cdf[k] = sum;
+        }
+        for (int k = 0; k < count; k++) {
+            m_cdf[k] /= sum;
+        }
+    }
+    int next(XorShift& rnd) const {
+        int k = static_cast<int>(lower_bound(m_cdf.begin(), m_cdf.end(), rnd.uniform()) - m_cdf.begin());
+        return (k < static_cast<int>(m_cdf.size())) ? k : static_cast<int>(m_cdf.size()) - 1;
+    }
+private:
+    vector<double> m_cdf;
+};
+
+// runs a synthetic workload on a Cache with a recorder attached, the recorded times are
+// replaced by made-up ones afterwards, so the trace has its bursts whatever the speed here
+// the popular keys are spread over the key space, they do not share a prefix
+bool generateTrace(const char* file, int keys, int operations) {
+    ofstream out(file);
+    if (!out) {
+        return false;
+    }
+    vector<string> names(keys);
+    for (int k = 0; k < keys; k++) {
+        names[k] = "user" + to_string((static_cast<unsigned long long>(k) * 2654435761u) % 1000000007u);
+    }
+    vector<int> ids(keys, 0);       // ID of a key in the cache, 0 while it is not there
+    vector<pair<int, int>> pending; // (operation to come back at, key) of removed records
+    Zipf zipf(keys);
+    XorShift rnd(17);
+
+    ostringstream recorded;
+    TraceRecorder recorder(recorded);
+    Cache cache(MINPRIME, wyHash, DEFPOLCY);
+    cache.setTraceRecorder(&recorder);
+    int loaded = 0;     // keys 0 to loaded-1 have been inserted once
+    // op counts the lines written, a pick that writes none does not use one up
+    for (int op = 0; op < operations; op = static_cast<int>(recorder.count())) {
+        bool burst = (op % BURSTEVERY) < BURSTLENGTH;
+        int writePercent = burst ? 40 : 10;
+        int r = static_cast<int>(rnd.next() % 100);
+        if (!pending.empty() && pending.front().first <= op) {
+            // a churned record comes back
+            int k = pending.front().second;
+            pop_heap(pending.begin(), pending.end(), greater<pair<int, int>>());
+            pending.pop_back();
+            ids[k] = MINID + static_cast<int>(rnd.next() % (MAXID - MINID));
+            cache.emplace(names[k], ids[k]);
+        } else if (loaded < keys && (loaded < keys / 2 || r < writePercent / 4)) {
+            // the first half of the keys is loaded at the start, the rest trickles in
+            ids[loaded] = MINID + static_cast<int>(rnd.next() % (MAXID - MINID));
+            cache.emplace(names[loaded], ids[loaded]);
+            loaded++;
+        } else if (loaded == 0) {
+            continue;   // no key to pick yet
+        } else if (r < writePercent) {
+            // a popular record is removed and inserted again soon, or gets a new ID
+            int k = zipf.next(rnd) % loaded;
+            if (ids[k] == 0) {
+                continue;
+            }
+            if (rnd.next() % 4 == 0) {
+                int id = MINID + static_cast<int>(rnd.next() % (MAXID - MINID));
+                cache.updateID(Person(names[k], ids[k]), id);
+                ids[k] = id;
+            } else {
+                cache.remove(names[k], ids[k]);
+                ids[k] = 0;
+                pending.push_back(make_pair(op + 1 + static_cast<int>(rnd.next() % MAXREINSERT), k));
+                push_heap(pending.begin(), pending.end(), greater<pair<int, int>>());
+            }
+        } else {
+            // a lookup, of a record that may be gone for the moment
+            int k = zipf.next(rnd) % loaded;
+            cache.getPersonView(names[k], (ids[k] == 0) ? MINID : ids[k]);
+        }
+    }
+    cache.setTraceRecorder(nullptr);
+
+    // made-up times: exponential gaps, shorter within a burst
+    istringstream in(recorded.str());
+    vector<TraceRecord> records;
+    if (!readTrace(in, records)) {
+        return false;
+    }
+    uint64_t now = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        bool burst = (i % BURSTEVERY) < BURSTLENGTH;
+        double gap = static_cast<double>(burst ? BURSTGAPNANOS : GAPNANOS);
+        now += static_cast<uint64_t>(-log(1.0 - rnd.uniform()) * gap);
+        records[i].m_nanos = now;
+        writeTraceRecord(out, records[i]);
+    }
+    return static_cast<bool>(out);
+}
+
+// runs the records on the cache in order, at full speed or at the times of the trace
+// returns the seconds it took, lag gets how far the replay fell behind the trace at most
+double replay(Cache& cache, const vector<TraceRecord>& records, bool realTime, uint64_t& lag, size_t& hits) {
+    lag = 0;
+    hits = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < records.size(); i++) {
+        const TraceRecord& record = records[i];
+        if (realTime) {
+            chrono::steady_clock::time_point due = start + chrono::nanoseconds(record.m_nanos);
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            if (now < due) {
+                if (due - now > chrono::nanoseconds(SPINNANOS)) {
+                    this_thread::sleep_until(due - chrono::nanoseconds(SPINNANOS));
+                }
+                while (chrono::steady_clock::now() < due) {
+                }
+            } else {
+                uint64_t behind = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(now - due).count());
+                lag = max(lag, behind);
+            }
+        }
+        switch (record.m_op) {
+        case OPINSERT:
+            cache.emplace(record.m_key, record.m_id);
+            break;
+        case OPREMOVE:
+            cache.remove(record.m_key, record.m_id);
+            break;
+        case OPLOOKUP:
+            hits += cache.getPersonView(record.m_key, record.m_id).getUsed();
+            break;
+        case OPUPDATE:
+            cache.updateID(Person(record.m_key, record.m_id), record.m_newID);
+            break;
+        default:
+            break;
+        }
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 2 && strcmp(argv[1], "-g") == 0) {
+        int keys = (argc > 3) ? atoi(argv[3]) : DEFKEYS;
+        int operations = (argc > 4) ? atoi(argv[4]) : DEFOPERATIONS;
+        if (keys < 2 || operations < 1) {
+            cout << "usage: " << argv[0] << " -g <trace> [keys] [operations]" << endl;
+            cout << "       keys has to be at least 2, operations at least 1" << endl;
+            return 1;
+        }
+        if (!generateTrace(argv[2], keys, operations)) {
+            cout << "cannot write the trace " << argv[2] << endl;
+            return 1;
+        }
+        cout << "wrote " << argv[2] << endl;
+        return 0;
+    }
+
+    const char* file = nullptr;
+    bool realTime = false;
+    bool background = false;
+    size_t size = MINPRIME;
+    prob_t policy = DEFPOLCY;
+    hash_view_fn hash = wyHash;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            realTime = true;
+        } else if (strcmp(argv[i], "-b") == 0) {
+            background = true;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            size = static_cast<size_t>(atol(argv[++i]));
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            i++;
+            int p = 0;
+            while (p < 5 && strcmp(argv[i], POLICYNAMES[p]) != 0) {
+                p++;
+            }
+            if (p == 5) {
+                cout << "unknown policy " << argv[i] << endl;
+                return 1;
+            }
+            policy = static_cast<prob_t>(p);
+        } else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
+            hash = findHashFunction(argv[++i]);
+            if (hash == nullptr) {
+                cout << "unknown hash function " << argv[i] << endl;
+                return 1;
+            }
+        } else if (argv[i][0] != '-' && file == nullptr) {
+            file = argv[i];
+        } else {
+            cout << "usage: " << argv[0] << " <trace> [-r] [-b] [-s size] [-p policy] [-h hash]" << endl;
+            cout << "       " << argv[0] << " -g <trace> [keys] [operations]" << endl;
+            return 1;
+        }
+    }
+    if (file == nullptr) {
+        cout << "usage: " << argv[0] << " <trace> [-r] [-b] [-s size] [-p policy] [-h hash]" << endl;
+        return 1;
+    }
+
+    ifstream in(file);
+    vector<TraceRecord> records;
+    if (!in || !readTrace(in, records)) {
+        cout << "cannot read the trace " << file << endl;
+        return 1;
+    }
+
+    Cache cache(size, hash, policy);
+    if (background) {
+        cache.startBackgroundRehash();
+    }
+    cache.setLatencyTracking(true);
+    uint64_t lag;
+    size_t hits;
+    double seconds = replay(cache, records, realTime, lag, hits);
+    cache.stopBackgroundRehash();
+
+    cout << records.size() << " operations in " << seconds << " s, "
+         << static_cast<long long>(records.size() / seconds) << " ops/s";
+    if (realTime && !records.empty()) {
+        cout << " (trace: " << records.back().m_nanos / 1e9 << " s, up to " << lag / 1000
+             << " us behind)";
+    }
+    cout << endl << endl;
+
+    cout << left << setw(11) << "operation" << setw(10) << "count" << setw(9) << "mean ns" << setw(9) << "p50"
+         << setw(9) << "p99" << setw(9) << "p999" << "max" << endl;
+    for (int op = 0; op < NUMOPS; op++) {
+        LatencySummary s = cache.latency(static_cast<op_t>(op));
+        cout << setw(11) << OPNAMES[op] << setw(10) << s.m_count << setw(9) << static_cast<long long>(s.m_mean)
+             << setw(9) << s.m_p50 << setw(9) << s.m_p99 << setw(9) << s.m_p999 << s.m_max << endl;
+    }
+
+    CacheMetrics m = cache.metrics();
+    CacheStats stats = cache.analyze();
+    cout << endl << "lookup hits: " << hits << " of " << cache.latency(OPLOOKUP).m_count << endl;
+    if (m.m_enabled) {
+        cout << "rehashes: " << m.m_loadRehashes << " by load, " << m.m_deletedRehashes
+             << " by deleted markers, " << m.m_migrated << " records moved" << endl;
+        cout << "probes per search: " << static_cast<double>(m.m_probes) / max<uint64_t>(m.m_searches, 1)
+             << ", deleted slots reused: " << m.m_tombstoneReuses << endl;
+    }
+    cout << "final table: " << stats.m_current.m_capacity << " buckets, " << stats.m_current.m_live
+         << " live, " << stats.m_current.m_deleted << " deleted, load " << cache.lambda() << endl;
+    return 0;
+}
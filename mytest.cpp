@@ -1,10 +1,17 @@
 // CMSC 341 - Fall 2025 - Project 4
 // mytest.cpp - Test file for Cache class
 #include "cache.h"
+#include "shardedcache.h"
+#include "hashes.h"
 #include <math.h>
 #include <algorithm>
 #include <random>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <sstream>
 using namespace std;
 
 const int MINSEARCH = 0;
@@ -114,6 +121,32 @@ unsigned int hashCode(const string str) {
     return val;
 }
 
+// Hash function that reads the key in place
+unsigned int hashCodeView(string_view str) {
+    unsigned int val = 0;
+    const unsigned int thirtyThree = 33;
+    for (size_t i = 0; i < str.length(); i++)
+        val = val * thirtyThree + str[i];
+    return val;
+}
+
+// counts heap allocations, used to check the paths that should not allocate
+static atomic<long> allocations(0);
+void* operator new(size_t size) {
+    allocations++;
+    void* block = malloc(size == 0 ? 1 : size);
+    if (block == nullptr) {
+        throw bad_alloc();
+    }
+    return block;
+}
+void operator delete(void* block) noexcept {
+    free(block);
+}
+void operator delete(void* block, size_t) noexcept {
+    free(block);
+}
+
 class Tester {
 public:
     // Test insertion with non-colliding keys
@@ -161,6 +194,94 @@ public:
     // Test lambda and deletedRatio calculations
     bool testLambdaAndDeletedRatio();
 
+    // Composite (key, ID) hashing tests
+    // Test composite hashing spreads records that share a key
+    bool testCompositeHashSpread();
+    // Test insert/getPerson/remove with composite hashing and skewed keys
+    bool testCompositeHashSkewedKeys();
+    // Test updateID moves the record with composite hashing
+    bool testCompositeHashUpdateID();
+
+    // Test stored slot hashes stay consistent through a rehash
+    bool testStoredHashAfterRehash();
+
+    // SWISS group probing tests
+    // Test SWISS probing with colliding keys through rehashes and removals
+    bool testSwissProbingColliding();
+    // Test SWISS probing keeps working above the 0.5 load factor
+    bool testSwissHighLoad();
+    // Test changing the policy to and from SWISS during rehashes
+    bool testSwissPolicyChange();
+
+    // ROBINHOOD probing tests
+    // Test ROBINHOOD insert/remove churn leaves no deleted markers
+    bool testRobinHoodChurn();
+    // Test ROBINHOOD probe distances and ordering after churn
+    bool testRobinHoodInvariant();
+    // Test removing from an old ROBINHOOD table during a rehash
+    bool testRobinHoodOldTableRemove();
+
+    // Test the table grows past the old 99991 bucket ceiling
+    bool testLargeCapacity();
+    // Test table capacities come from the prime ladder
+    bool testPrimeLadderCapacity();
+
+    // Incremental and background rehash tests
+    // Test each insert moves at most the per-operation budget of old buckets
+    bool testTransferBudget();
+    // Test drainRehash finishes a running rehash outside of insert and remove
+    bool testDrainRehash();
+    // Test the background migrator finishes a rehash that only lookups follow
+    bool testBackgroundRehashReads();
+    // Test inserts, removes and ID updates while the migrator runs
+    bool testBackgroundRehashWrites();
+
+    // Concurrency tests
+    // Test ShardedCache with several threads inserting, removing and updating
+    bool testShardedCacheThreads();
+    // Test lookups on many threads racing one writer thread
+    bool testSharedReadsStress();
+
+    // Lookup and insert path tests
+    // Test the batch operations give the same results as one call per record
+    bool testBatchOperations();
+    // Test getPersonView finds the same records as getPerson
+    bool testPersonView();
+    // Test the common paths do not allocate with a string_view hash function
+    bool testNoAllocationPaths();
+    // Test every operation hashes its key exactly once
+    bool testHashOncePerOperation();
+    // Test the single probe of an insert
+    bool testSinglePassInsert();
+    // Test the hash functions of hashes.h
+    bool testHashLibrary();
+
+    // Instrumentation tests
+    // Test analyze on probe chains, clusters and deleted markers
+    bool testAnalyze();
+    // Test the metrics counters
+    bool testMetrics();
+    // Test the latency histograms
+    bool testLatency();
+    // Test trace recording and reading a trace back
+    bool testTrace();
+
+    // Memory tests
+    // Test the key handoff of a rehash
+    bool testKeyHandoff();
+    // Test moving records to the new table allocates nothing
+    bool testMigrationAllocations();
+    // Test the 16-byte slots and memoryUsage
+    bool testCompactSlots();
+    // Test a COMPOSITEHASH updateID whose insert fails keeps the record
+    bool testUpdateIDMoveFailure();
+
+    // Test ShardedCache with COMPOSITEHASH spreads a few keys over the shards
+    bool testShardedCompositeHash();
+
+    // Test a Cache built with a negative or absurd size gets a usable table
+    bool testConstructorSizeClamp();
+
 private:
     // Helper function to generate unique keys for non-colliding tests
     string generateUniqueKey(int index);
@@ -828,173 +949,1992 @@ bool Tester::testLambdaAndDeletedRatio() {
     return result;
 }
 
-int main() {
-    Tester tester;
-
-    cout << "Testing Cache Class" << endl;
-    cout << "===================" << endl << endl;
+// Test 22: Test composite hashing spreads records that share a key
+// Tests that 40 records with the same key get many different home buckets
+bool Tester::testCompositeHashSpread() {
+    Cache keyCache(MINPRIME, hashCode, DOUBLEHASH, KEYHASH);
+    Cache pairCache(MINPRIME, hashCode, DOUBLEHASH, COMPOSITEHASH);
+    vector<int> keyBuckets;
+    vector<int> pairBuckets;
 
-    // Test 1: Insert non-colliding keys
-    cout << "Test 1: Insert with non-colliding keys (50 nodes): ";
-    if (tester.testInsertNonColliding()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    for (int i = 0; i < 40; i++) {
+        keyBuckets.push_back(keyCache.bucketHash(searchStr[0], MINID + i) % keyCache.m_currentCap);
+        pairBuckets.push_back(pairCache.bucketHash(searchStr[0], MINID + i) % pairCache.m_currentCap);
     }
+    sort(keyBuckets.begin(), keyBuckets.end());
+    sort(pairBuckets.begin(), pairBuckets.end());
+    int keyDistinct = unique(keyBuckets.begin(), keyBuckets.end()) - keyBuckets.begin();
+    int pairDistinct = unique(pairBuckets.begin(), pairBuckets.end()) - pairBuckets.begin();
 
-    // Test 2: Insert colliding keys
-    cout << "Test 2: Insert with colliding keys (50 nodes): ";
-    if (tester.testInsertColliding()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
-    }
+    // key-only hashing puts every record in one home bucket
+    // composite hashing should use most of the buckets it could
+    return (keyDistinct == 1 && pairDistinct >= 25);
+}
 
-    // Test 3: getPerson error case
-    cout << "Test 3: getPerson for non-existent person: ";
-    if (tester.testGetPersonNotFound()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
-    }
+// Test 23: Test insert/getPerson/remove with composite hashing and skewed keys
+// Tests 400 records over only 4 keys, through several rehashes, with removals
+bool Tester::testCompositeHashSkewedKeys() {
+    Cache cache(MINPRIME, hashCode, QUADRATIC, COMPOSITEHASH);
+    vector<Person> dataList;
+    bool result = true;
 
-    // Test 4: getPerson with non-colliding keys
-    cout << "Test 4: getPerson with non-colliding keys: ";
-    if (tester.testGetPersonNonColliding()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    for (int i = 0; i < 400; i++) {
+        Person person(searchStr[i % 4], MINID + i, true);
+        dataList.push_back(person);
+        if (!cache.insert(person)) {
+            result = false;
+        }
     }
 
-    // Test 5: getPerson with colliding keys
-    cout << "Test 5: getPerson with colliding keys (no rehash): ";
-    if (tester.testGetPersonColliding()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    // remove every third record
+    for (int i = 0; i < 400; i += 3) {
+        if (!cache.remove(dataList[i])) {
+            result = false;
+        }
     }
 
-    // Test 6: Remove non-colliding keys
-    cout << "Test 6: Remove with non-colliding keys: ";
-    if (tester.testRemoveNonColliding()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    Person emptyPerson;
+    for (int i = 0; i < 400; i++) {
+        Person found = cache.getPerson(dataList[i].getKey(), dataList[i].getID());
+        if (i % 3 == 0) {
+            if (!(found == emptyPerson)) {
+                result = false;
+            }
+        } else if (!(found == dataList[i])) {
+            result = false;
+        }
     }
 
-    // Test 7: Remove colliding keys
-    cout << "Test 7: Remove with colliding keys (no rehash): ";
-    if (tester.testRemoveColliding()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    return result;
+}
+
+// Test 24: Test updateID moves the record with composite hashing
+// Tests that the record is found under the new ID only, and that an update
+// onto an existing (key, ID) pair is rejected
+bool Tester::testCompositeHashUpdateID() {
+    Cache cache(MINPRIME, hashCode, DOUBLEHASH, COMPOSITEHASH);
+    bool result = true;
+
+    for (int i = 0; i < 30; i++) {
+        cache.insert(Person(searchStr[1], MINID + i, true));
     }
 
-    // Test 8: Rehash triggered by insertion
-    cout << "Test 8: Rehash triggered by insertion (load factor): ";
-    if (tester.testRehashTriggeredByInsertion()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    Person person(searchStr[1], MINID + 5, true);
+    if (!cache.updateID(person, MAXID)) {
+        result = false;
+    }
+    Person found = cache.getPerson(searchStr[1], MAXID);
+    if (found.getKey() != searchStr[1] || found.getID() != MAXID) {
+        result = false;
+    }
+    if (cache.getPerson(searchStr[1], MINID + 5).getUsed()) {
+        result = false;
     }
 
-    // Test 9: Rehash completion after insertion
-    cout << "Test 9: Rehash completion after load factor trigger: ";
-    if (tester.testRehashCompletionAfterInsertion()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    // (key, MINID + 6) already exists
+    Person other(searchStr[1], MINID + 7, true);
+    if (cache.updateID(other, MINID + 6)) {
+        result = false;
+    }
+    if (!cache.getPerson(searchStr[1], MINID + 7).getUsed()) {
+        result = false;
     }
 
-    // Test 10: Rehash triggered by removal
-    cout << "Test 10: Rehash triggered by removal (delete ratio): ";
-    if (tester.testRehashTriggeredByRemoval()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    return result;
+}
+
+// Test 25: Test stored slot hashes stay consistent through a rehash
+// Tests that every live slot in both tables holds the bucket hash of its record
+// while the incremental transfer reuses the stored hashes
+bool Tester::testStoredHashAfterRehash() {
+    Random RndID(MINID, MAXID);
+    Cache cache(MINPRIME, hashCode, DOUBLEHASH, COMPOSITEHASH);
+    bool result = true;
+
+    for (int i = 0; i < 120; i++) {
+        cache.insert(Person(generateUniqueKey(i % 30), RndID.getRandNum(), true));
+
+        for (size_t j = 0; j < cache.m_currentCap; j++) {
+            const Slot& slot = cache.m_currentTable[j];
+            if (isLive(cache.m_currentCtrl[j]) &&
+                slot.m_hash != cache.bucketHash(slot.getKey(), slot.getID())) {
+                result = false;
+            }
+        }
+        for (size_t j = 0; cache.m_oldTable != nullptr && j < cache.m_oldCap; j++) {
+            const Slot& slot = cache.m_oldTable[j];
+            if (isLive(cache.m_oldCtrl[j]) &&
+                slot.m_hash != cache.bucketHash(slot.getKey(), slot.getID())) {
+                result = false;
+            }
+        }
     }
 
-    // Test 11: Rehash completion after removal
-    cout << "Test 11: Rehash completion after delete ratio trigger: ";
-    if (tester.testRehashCompletionAfterRemoval()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    return result;
+}
+
+// Test 26: Test SWISS probing with colliding keys through rehashes and removals
+// Tests 300 records over only 4 keys, so every group of a key is full of
+// fingerprint matches, then removes half of them
+bool Tester::testSwissProbingColliding() {
+    Cache cache(MINPRIME, hashCode, SWISS);
+    vector<Person> dataList;
+    bool result = true;
+
+    for (int i = 0; i < 300; i++) {
+        Person person(searchStr[i % 4], MINID + i, true);
+        dataList.push_back(person);
+        if (!cache.insert(person)) {
+            result = false;
+        }
     }
 
-    // Test 12: updateID normal case
-    cout << "Test 12: updateID normal case: ";
-    if (tester.testUpdateIDNormal()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    for (int i = 0; i < 300; i += 2) {
+        if (!cache.remove(dataList[i])) {
+            result = false;
+        }
     }
 
-    // Test 13: updateID error case
-    cout << "Test 13: updateID error cases (invalid ID): ";
-    if (tester.testUpdateIDError()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    Person emptyPerson;
+    for (int i = 0; i < 300; i++) {
+        Person found = cache.getPerson(dataList[i].getKey(), dataList[i].getID());
+        if (i % 2 == 0) {
+            if (!(found == emptyPerson)) {
+                result = false;
+            }
+        } else if (!(found == dataList[i])) {
+            result = false;
+        }
     }
 
-    // Test 14: Insert with invalid ID below MINID
-    cout << "Test 14: Insert with invalid ID (below MINID): ";
-    if (tester.testInsertInvalidIDBelowMin()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    return result;
+}
+
+// Test 27: Test SWISS probing keeps working above the 0.5 load factor
+// Tests that a SWISS table is only rehashed past its higher load limit
+// and that every record is found at that load
+bool Tester::testSwissHighLoad() {
+    Random RndID(MINID, MAXID);
+    Cache cache(MINPRIME, hashCode, SWISS, COMPOSITEHASH);
+    vector<Person> dataList;
+    bool result = true;
+
+    // 85 records in 101 buckets stays under the 0.875 limit
+    for (int i = 0; i < 85; i++) {
+        Person person(searchStr[i % 8], MINID + i, true);
+        dataList.push_back(person);
+        if (!cache.insert(person)) {
+            result = false;
+        }
+    }
+    if (cache.m_oldTable != nullptr || cache.m_currentCap != MINPRIME || cache.lambda() < 0.8f) {
+        result = false;
     }
 
-    // Test 15: Insert with invalid ID above MAXID
-    cout << "Test 15: Insert with invalid ID (above MAXID): ";
-    if (tester.testInsertInvalidIDAboveMax()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    for (int i = 0; i < 85; i++) {
+        Person found = cache.getPerson(dataList[i].getKey(), dataList[i].getID());
+        if (!(found == dataList[i])) {
+            result = false;
+        }
+    }
+    if (cache.getPerson(searchStr[0], MAXID).getUsed()) {
+        result = false;
     }
 
-    // Test 16: Remove non-existent person
-    cout << "Test 16: Remove non-existent person: ";
-    if (tester.testRemoveNonExistent()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    return result;
+}
+
+// Test 28: Test changing the policy to and from SWISS during rehashes
+// Tests that records stay reachable while the old and current tables use different policies
+bool Tester::testSwissPolicyChange() {
+    Random RndID(MINID, MAXID);
+    Cache cache(MINPRIME, hashCode, LINEAR);
+    vector<Person> dataList;
+    bool result = true;
+
+    cache.changeProbPolicy(SWISS);
+    for (int i = 0; i < 150; i++) {
+        if (i == 100) {
+            cache.changeProbPolicy(DOUBLEHASH);
+        }
+        Person person(generateUniqueKey(i % 40), RndID.getRandNum(), true);
+        if (cache.insert(person)) {
+            dataList.push_back(person);
+        }
+
+        // check everything inserted so far, mid-transfer included
+        for (unsigned int j = 0; j < dataList.size(); j++) {
+            Person found = cache.getPerson(dataList[j].getKey(), dataList[j].getID());
+            if (!(found == dataList[j])) {
+                result = false;
+            }
+        }
     }
 
-    // Test 17: Duplicate insertion prevention
-    cout << "Test 17: Duplicate insertion prevention: ";
-    if (tester.testDuplicatePrevention()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    return result;
+}
+
+// Test 29: Test ROBINHOOD insert/remove churn leaves no deleted markers
+// Tests many insert/remove cycles on colliding keys, checking that the table
+// never holds a deleted marker and that every live record is found
+bool Tester::testRobinHoodChurn() {
+    Random RndIdx(0, 59);
+    Cache cache(MINPRIME, hashCode, ROBINHOOD);
+    bool present[60] = {false};
+    bool result = true;
+
+    for (int round = 0; round < 2000; round++) {
+        int i = RndIdx.getRandNum();
+        Person person(searchStr[i % 4], MINID + i, true);
+        if (present[i]) {
+            if (!cache.remove(person)) {
+                result = false;
+            }
+        } else if (!cache.insert(person)) {
+            result = false;
+        }
+        present[i] = !present[i];
     }
 
-    // Test 18: Probing policy change
-    cout << "Test 18: Probing policy change: ";
-    if (tester.testProbingPolicyChange()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    if (cache.m_currNumDeleted != 0) {
+        result = false;
+    }
+    for (size_t j = 0; j < cache.m_currentCap; j++) {
+        if (cache.m_currentCtrl[j] == DELETED) {
+            result = false;
+        }
+    }
+    for (int i = 0; i < 60; i++) {
+        if (cache.getPerson(searchStr[i % 4], MINID + i).getUsed() != present[i]) {
+            result = false;
+        }
     }
 
-    // Test 19: Linear probing
-    cout << "Test 19: Linear probing with collisions: ";
-    if (tester.testLinearProbing()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    return result;
+}
+
+// Test 30: Test ROBINHOOD probe distances and ordering after churn
+// the distance of a record from its home bucket is computed from its stored hash,
+// a record is never more than one step further from home than the one before it,
+// and a lookup of the record probes exactly distance + 1 buckets
+bool Tester::testRobinHoodInvariant() {
+    Random RndID(MINID, MAXID);
+    Cache cache(MINPRIME, hashCode, ROBINHOOD, COMPOSITEHASH);
+    vector<Person> dataList;
+    bool result = true;
+
+    for (int i = 0; i < 45; i++) {
+        Person person(searchStr[i % 8], RndID.getRandNum(), true);
+        if (cache.insert(person)) {
+            dataList.push_back(person);
+        }
+    }
+    for (unsigned int i = 0; i < dataList.size(); i += 3) {
+        cache.remove(dataList[i]);
     }
 
-    // Test 20: Quadratic probing
-    cout << "Test 20: Quadratic probing with collisions: ";
-    if (tester.testQuadraticProbing()) {
-        cout << "PASSED" << endl;
-    } else {
-        cout << "FAILED" << endl;
+    int cap = static_cast<int>(cache.m_currentCap);
+    for (int j = 0; j < cap; j++) {
+        if (!isLive(cache.m_currentCtrl[j])) {
+            continue;
+        }
+        // the probe distance from home, as the table computes it from the hash
+        const Slot& slot = cache.m_currentTable[j];
+        int dist = (j - static_cast<int>(slot.m_hash % cap) + cap) % cap;
+        int prev = (j == 0) ? cap - 1 : j - 1;
+        int prevDist = (prev - static_cast<int>(cache.m_currentTable[prev].m_hash % cap) + cap) % cap;
+        if (dist > 0 && (!isLive(cache.m_currentCtrl[prev]) || prevDist + 1 < dist)) {
+            result = false;
+        }
+        cache.resetMetrics();
+        size_t found = cache.findRecord(cache.m_currentTable, cache.m_currentCtrl, cache.m_currentCap,
+                                        cache.m_currentMod, ROBINHOOD, slot.m_hash, slot.getKey(), slot.getID());
+        CacheMetrics metrics = cache.metrics();
+        if (found != static_cast<size_t>(j) ||
+            (metrics.m_enabled && metrics.m_probes != static_cast<uint64_t>(dist) + 1)) {
+            result = false;
+        }
     }
 
-    // Test 21: Lambda and deletedRatio calculations
+    return result;
+}
+
+// Test 31: Test removing from an old ROBINHOOD table during a rehash
+// Tests that records removed from the old table are gone, and that the
+// records behind them in the cluster are still found and transferred
+bool Tester::testRobinHoodOldTableRemove() {
+    Cache cache(MINPRIME, hashCode, ROBINHOOD);
+    vector<Person> dataList;
+    bool result = true;
+
+    // the 51st insert starts a rehash
+    for (int i = 0; i < 51; i++) {
+        Person person(searchStr[i % 4], MINID + i, true);
+        dataList.push_back(person);
+        cache.insert(person);
+    }
+    if (cache.m_oldTable == nullptr) {
+        result = false;
+    }
+
+    for (int i = 0; i < 51; i += 2) {
+        if (!cache.remove(dataList[i])) {
+            result = false;
+        }
+    }
+    Person emptyPerson;
+    for (int i = 0; i < 51; i++) {
+        Person found = cache.getPerson(dataList[i].getKey(), dataList[i].getID());
+        if ((i % 2 == 0) ? !(found == emptyPerson) : !(found == dataList[i])) {
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+// Test 32: Test the table grows past the old 99991 bucket ceiling
+// Tests 200000 records, four times what a 99991 bucket table could hold
+// under the 0.5 load factor, then removes a quarter of them
+bool Tester::testLargeCapacity() {
+    Cache cache(MINPRIME, hashCode, DOUBLEHASH, COMPOSITEHASH);
+    const int numItems = 200000;
+    bool result = true;
+
+    for (int i = 0; i < numItems; i++) {
+        if (!cache.insert(Person("user" + to_string(i), MINID + i, true))) {
+            result = false;
+        }
+    }
+    if (cache.m_currentCap <= 99991 || cache.lambda() > 0.5f) {
+        result = false;
+    }
+
+    for (int i = 0; i < numItems; i += 4) {
+        if (!cache.remove(Person("user" + to_string(i), MINID + i, true))) {
+            result = false;
+        }
+    }
+    for (int i = 0; i < numItems; i++) {
+        bool found = cache.getPerson("user" + to_string(i), MINID + i).getUsed();
+        if (found != (i % 4 != 0)) {
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+// Test 33: Test table capacities come from the prime ladder
+// Tests that requested and rehashed capacities are primes large enough for
+// the request, and that the records are found with the fastmod base index
+bool Tester::testPrimeLadderCapacity() {
+    bool result = true;
+    size_t sizes[] = {0, 101, 102, 1000, 5000, 99991, 150000};
+    for (size_t size : sizes) {
+        Cache cache(size, hashCode, LINEAR);
+        size_t cap = cache.m_currentCap;
+        if (cap < size || cap < MINPRIME) {
+            result = false;
+        }
+        for (size_t d = 2; d * d <= cap; d++) {
+            if (cap % d == 0) {
+                result = false;
+            }
+        }
+    }
+
+    Cache cache(MINPRIME, hashCode, LINEAR);
+    vector<Person> dataList;
+    for (int i = 0; i < 300; i++) {
+        Person person(generateUniqueKey(i % 50) + searchStr[i % 8], MINID + i, true);
+        dataList.push_back(person);
+        cache.insert(person);
+    }
+    if (cache.m_currentCap < 4 * 50) {
+        result = false;
+    }
+    for (unsigned int i = 0; i < dataList.size(); i++) {
+        Person found = cache.getPerson(dataList[i].getKey(), dataList[i].getID());
+        if (!(found == dataList[i])) {
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+// Test 34: Test each insert moves at most the per-operation budget of old buckets
+// and the rehash completes before the new table reaches its own load limit
+bool Tester::testTransferBudget() {
+    Random RndID(MINID, MAXID);
+    Cache cache(MINPRIME, hashCode, LINEAR);
+    cache.setTransferBudget(8);
+    vector<Person> dataList;
+    bool result = true;
+
+    for (int i = 0; i < 3000; i++) {
+        Person person("budget" + to_string(i), RndID.getRandNum(), true);
+        size_t before = cache.m_transferIndex;
+        bool migrating = cache.m_oldTable != nullptr;
+        if (!cache.insert(person)) {
+            result = false;
+        }
+        dataList.push_back(person);
+
+        // an insert during a rehash scans exactly the step, the last one may scan less
+        if (migrating && cache.m_oldTable != nullptr &&
+            cache.m_transferIndex - before != cache.transferStep()) {
+            result = false;
+        }
+        if (cache.transferStep() != 0 && cache.transferStep() < 8) {
+            result = false;
+        }
+        // the old table is always gone before the load could start another rehash
+        if (cache.m_oldTable != nullptr && cache.lambda() > 0.5f) {
+            result = false;
+        }
+    }
+
+    for (size_t i = 0; i < dataList.size(); i++) {
+        Person found = cache.getPerson(dataList[i].getKey(), dataList[i].getID());
+        if (!(found == dataList[i])) {
+            result = false;
+        }
+    }
+    return result;
+}
+
+// Test 35: Test drainRehash finishes a running rehash outside of insert and remove
+bool Tester::testDrainRehash() {
+    Random RndID(MINID, MAXID);
+    Cache cache(MINPRIME, hashCode, QUADRATIC);
+    cache.setTransferBudget(1);
+    vector<Person> dataList;
+    bool result = true;
+
+    // insert until a rehash starts
+    int i = 0;
+    while (cache.m_oldTable == nullptr) {
+        Person person("drain" + to_string(i++), RndID.getRandNum(), true);
+        cache.insert(person);
+        dataList.push_back(person);
+    }
+
+    // a partial drain moves only the requested buckets
+    size_t before = cache.m_transferIndex;
+    if (!cache.drainRehash(5) || cache.m_transferIndex != before + 5) {
+        result = false;
+    }
+
+    // zero drains everything and releases the old table
+    if (cache.drainRehash(0) || cache.m_oldTable != nullptr || cache.transferStep() != 0) {
+        result = false;
+    }
+    if (cache.drainRehash(0)) {
+        result = false;     // nothing left to do
+    }
+
+    for (size_t j = 0; j < dataList.size(); j++) {
+        Person found = cache.getPerson(dataList[j].getKey(), dataList[j].getID());
+        if (!(found == dataList[j])) {
+            result = false;
+        }
+    }
+    return result;
+}
+
+// Test 36: Test the background migrator finishes a rehash that only lookups follow,
+// while lookups on several threads keep finding every record
+bool Tester::testBackgroundRehashReads() {
+    Random RndID(MINID, MAXID);
+    prob_t policies[] = {QUADRATIC, SWISS};
+    bool result = true;
+
+    for (prob_t policy : policies) {
+        Cache cache(MINPRIME, hashCode, policy);
+        cache.changeProbPolicy(policy);
+        cache.setTransferBudget(1);
+        vector<Person> dataList;
+
+        // insert until a rehash starts, with a budget of one it is far from done
+        int i = 0;
+        while (!cache.isRehashing() || dataList.size() < 5000) {
+            Person person("bg" + to_string(i++), RndID.getRandNum(), true);
+            if (cache.insert(person)) {
+                dataList.push_back(person);
+            }
+        }
+
+        cache.startBackgroundRehash();
+        atomic<int> misses(0);
+        vector<thread> readers;
+        for (int t = 0; t < 4; t++) {
+            readers.push_back(thread([&cache, &dataList, &misses]() {
+                int rounds = 0;
+                while (cache.isRehashing() || rounds < 2) {
+                    for (size_t j = 0; j < dataList.size(); j++) {
+                        Person found = cache.getPerson(dataList[j].getKey(), dataList[j].getID());
+                        if (!(found == dataList[j])) {
+                            misses++;
+                        }
+                    }
+                    rounds++;
+                }
+            }));
+        }
+        for (size_t t = 0; t < readers.size(); t++) {
+            readers[t].join();
+        }
+
+        if (misses != 0 || cache.isRehashing() || cache.m_oldTable != nullptr) {
+            result = false;
+        }
+        cache.stopBackgroundRehash();
+    }
+    return result;
+}
+
+// Test 37: Test inserts, removes and ID updates stay correct while the migrator
+// runs, including ROBINHOOD lookups that wait for it
+bool Tester::testBackgroundRehashWrites() {
+    Random RndID(MINID, MAXID);
+    prob_t policies[] = {LINEAR, SWISS, ROBINHOOD};
+    bool result = true;
+
+    for (prob_t policy : policies) {
+        Cache cache(MINPRIME, hashCode, policy, COMPOSITEHASH);
+        cache.changeProbPolicy(policy);
+        cache.startBackgroundRehash();
+        vector<Person> dataList;
+
+        for (int i = 0; i < 20000; i++) {
+            Person person("fg" + to_string(i), RndID.getRandNum(), true);
+            if (cache.insert(person)) {
+                dataList.push_back(person);
+            }
+        }
+        // remove every third record and move every other one to a new ID
+        vector<Person> kept;
+        for (size_t j = 0; j < dataList.size(); j++) {
+            if (j % 3 == 0) {
+                if (!cache.remove(dataList[j])) {
+                    result = false;
+                }
+            } else if (j % 2 == 0) {
+                Person moved(dataList[j].getKey(), dataList[j].getID() == MAXID ? MINID : dataList[j].getID() + 1, true);
+                if (!cache.updateID(dataList[j], moved.getID())) {
+                    result = false;
+                }
+                kept.push_back(moved);
+            } else {
+                kept.push_back(dataList[j]);
+            }
+        }
+
+        for (size_t j = 0; j < kept.size(); j++) {
+            Person found = cache.getPerson(kept[j].getKey(), kept[j].getID());
+            if (!(found == kept[j])) {
+                result = false;
+            }
+        }
+        for (size_t j = 0; j < dataList.size(); j += 3) {
+            if (cache.getPerson(dataList[j].getKey(), dataList[j].getID()).getUsed()) {
+                result = false;
+            }
+        }
+        // the destructor stops the migrator
+    }
+    return result;
+}
+
+// Test 38: Test ShardedCache with several threads inserting, removing and
+// updating their own records while other threads read
+bool Tester::testShardedCacheThreads() {
+    ShardedCache cache(MINPRIME, hashCode, DOUBLEHASH, KEYHASH, 8);
+    const int THREADS = 4;
+    const int PERTHREAD = 5000;
+    bool result = (cache.numShards() == 8);
+    atomic<bool> failed(false);
+    atomic<bool> writing(true);
+
+    // the preloaded records are read all the time
+    for (int i = 0; i < 1000; i++) {
+        cache.insert(Person("shared" + to_string(i), MINID + i, true));
+    }
+
+    vector<thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.push_back(thread([&cache, &failed, t]() {
+            for (int i = 0; i < PERTHREAD; i++) {
+                if (!cache.insert(Person("w" + to_string(t) + "-" + to_string(i), MINID + i, true))) {
+                    failed = true;
+                }
+            }
+            // remove the odd records and move the even ones to a new ID
+            for (int i = 0; i < PERTHREAD; i++) {
+                Person person("w" + to_string(t) + "-" + to_string(i), MINID + i, true);
+                bool done = (i % 2 == 1) ? cache.remove(person) : cache.updateID(person, MAXID - i);
+                if (!done) {
+                    failed = true;
+                }
+            }
+        }));
+    }
+    for (int t = 0; t < THREADS; t++) {
+        threads.push_back(thread([&cache, &failed, &writing]() {
+            while (writing) {
+                for (int i = 0; i < 1000; i++) {
+                    if (!cache.getPerson("shared" + to_string(i), MINID + i).getUsed()) {
+                        failed = true;
+                    }
+                }
+            }
+        }));
+    }
+    for (int t = 0; t < THREADS; t++) {
+        threads[t].join();
+    }
+    writing = false;
+    for (size_t t = THREADS; t < threads.size(); t++) {
+        threads[t].join();
+    }
+
+    if (failed || cache.size() != 1000 + THREADS * PERTHREAD / 2) {
+        result = false;
+    }
+    for (int t = 0; t < THREADS; t++) {
+        for (int i = 0; i < PERTHREAD; i++) {
+            string key = "w" + to_string(t) + "-" + to_string(i);
+            bool found = cache.getPerson(key, MAXID - i).getUsed();
+            if (found != (i % 2 == 0) || cache.getPerson(key, MINID + i).getUsed()) {
+                result = false;
+            }
+        }
+    }
+    return result;
+}
+
+// Test 39: Test lookups on many threads racing one writer thread
+// records the writer has published must be found, removed ones must not,
+// across rehashes of every policy and with the background migrator, and the
+// lookups finish while the writer lock is held by a thread that keeps writing
+bool Tester::testSharedReadsStress() {
+    prob_t policies[] = {LINEAR, QUADRATIC, DOUBLEHASH, SWISS, ROBINHOOD, SWISS};
+    const int READERS = 6;
+    const int RECORDS = 20000;
+    bool result = true;
+
+    for (int p = 0; p < 6; p++) {
+        Cache cache(MINPRIME, hashCode, policies[p]);
+        cache.changeProbPolicy(policies[p]);
+        cache.setSharedReads(true);
+        if (p == 5) {
+            cache.startBackgroundRehash();
+        }
+        atomic<int> inserted(0);    // records 0 .. inserted-1 are in the cache
+        atomic<int> removed(0);     // records i % 3 == 0 below removed are gone
+        atomic<bool> failed(false);
+
+        vector<thread> readers;
+        for (int t = 0; t < READERS; t++) {
+            readers.push_back(thread([&cache, &inserted, &removed, &failed, t]() {
+                unsigned int r = t + 1;
+                while (inserted.load() < RECORDS && !failed) {
+                    int gone = removed.load();
+                    int count = inserted.load();
+                    if (count == 0) {
+                        continue;
+                    }
+                    r = r * 1103515245u + 12345u;
+                    int j = (r >> 8) % count;
+                    bool found = cache.getPerson("churn" + to_string(j), MINID + j).getUsed();
+                    bool expected = !(j % 3 == 0 && j < gone);
+                    // a record removed after the watermarks were read may be gone already
+                    if (found != expected && !(j % 3 == 0 && !found)) {
+                        failed = true;
+                    }
+                    // the same key with an ID that was never inserted
+                    if (cache.getPerson("churn" + to_string(j), MINID + j + 1).getUsed()) {
+                        failed = true;
+                    }
+                }
+            }));
+        }
+
+        // the writer inserts in order and removes every third record a while later
+        for (int i = 0; i < RECORDS; i++) {
+            if (!cache.insert(Person("churn" + to_string(i), MINID + i, true))) {
+                failed = true;
+            }
+            inserted.store(i + 1);
+            int old = i - 100;
+            if (old >= 0 && old % 3 == 0) {
+                if (!cache.remove(Person("churn" + to_string(old), MINID + old, true))) {
+                    failed = true;
+                }
+                removed.store(old + 1);
+            }
+        }
+        for (int t = 0; t < READERS; t++) {
+            readers[t].join();
+        }
+        if (failed) {
+            result = false;
+        }
+    }
+
+    // lookups never take the writer lock: this thread holds it and starts the readers
+    // in the middle of a long write section, so every lookup fails MAXRETRY times,
+    // and the lookups still finish while the lock is held
+    Cache cache(MINPRIME, hashCode, LINEAR);
+    cache.setSharedReads(true);
+    for (int i = 0; i < 50; i++) {
+        cache.insert(Person("held" + to_string(i), MINID + i, true));
+    }
+    cache.resetMetrics();
+    atomic<int> finished(0);
+    atomic<bool> failed(false);
+    cache.m_writeLock.lock();
+    cache.beginWrite();
+    vector<thread> readers;
+    for (int t = 0; t < READERS; t++) {
+        readers.push_back(thread([&cache, &finished, &failed]() {
+            for (int i = 0; i < 2000; i++) {
+                if (!cache.getPerson("held" + to_string(i % 50), MINID + i % 50).getUsed()) {
+                    failed = true;
+                }
+            }
+            finished++;
+        }));
+    }
+    this_thread::sleep_for(chrono::milliseconds(20));
+    cache.endWrite();
+    // more write sections while the readers go on
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    while (finished < READERS && chrono::steady_clock::now() - start < chrono::seconds(10)) {
+        this_thread::sleep_for(chrono::microseconds(100));
+        cache.beginWrite();
+        this_thread::sleep_for(chrono::microseconds(100));
+        cache.endWrite();
+    }
+    bool allFinished = (finished == READERS);
+    cache.m_writeLock.unlock();
+    for (int t = 0; t < READERS; t++) {
+        readers[t].join();
+    }
+    CacheMetrics metrics = cache.metrics();
+    if (!allFinished || failed ||
+        (metrics.m_enabled && (metrics.m_lookups != static_cast<uint64_t>(READERS) * 2000 ||
+                               metrics.m_backoffLookups < static_cast<uint64_t>(READERS)))) {
+        result = false;
+    }
+    return result;
+}
+
+// Test 40: Test the batch operations give the same results as one call per record,
+// for batches that span several blocks and trigger rehashes
+bool Tester::testBatchOperations() {
+    Cache cache(MINPRIME, hashCode, DOUBLEHASH);
+    const int COUNT = 1000;
+    vector<Person> people;
+    for (int i = 0; i < COUNT; i++) {
+        people.push_back(Person("batch" + to_string(i), MINID + i, true));
+    }
+    // an invalid ID and a duplicate inside the batch
+    people.push_back(Person("invalid", MINID - 1, true));
+    people.push_back(people[10]);
+    int total = static_cast<int>(people.size());
+    bool result = true;
+
+    bool* done = new bool[total];
+    if (cache.insertBatch(people.data(), total, done) != COUNT) {
+        result = false;
+    }
+    if (done[COUNT] || done[COUNT + 1] || !done[0] || !done[COUNT - 1]) {
+        result = false;
+    }
+
+    // look up the records and some misses
+    vector<Person> queries(people.begin(), people.end());
+    queries.push_back(Person("batch1", MINID + 2, true));
+    Person* found = new Person[queries.size()];
+    cache.getPersonBatch(queries.data(), static_cast<int>(queries.size()), found);
+    for (size_t i = 0; i < queries.size(); i++) {
+        if (!(found[i] == cache.getPerson(queries[i].getKey(), queries[i].getID())) ||
+            found[i].getUsed() != cache.getPerson(queries[i].getKey(), queries[i].getID()).getUsed()) {
+            result = false;
+        }
+    }
+    if (!found[0].getUsed() || found[COUNT].getUsed() || found[queries.size() - 1].getUsed()) {
+        result = false;
+    }
+
+    // remove every other record, the duplicate entry finds nothing the second time
+    vector<Person> removals;
+    for (int i = 0; i < COUNT; i += 2) {
+        removals.push_back(people[i]);
+    }
+    removals.push_back(people[0]);
+    if (cache.removeBatch(removals.data(), static_cast<int>(removals.size())) != COUNT / 2) {
+        result = false;
+    }
+    for (int i = 0; i < COUNT; i++) {
+        if (cache.getPerson(people[i].getKey(), people[i].getID()).getUsed() != (i % 2 == 1)) {
+            result = false;
+        }
+    }
+
+    delete[] done;
+    delete[] found;
+    return result;
+}
+
+// Test 41: Test getPersonView finds the same records as getPerson, and the
+// view refers to the stored key bytes rather than a copy
+bool Tester::testPersonView() {
+    Cache cache(MINPRIME, hashCode, SWISS);
+    cache.changeProbPolicy(SWISS);
+    bool result = true;
+    vector<Person> dataList;
+    for (int i = 0; i < 500; i++) {
+        // keys long enough to need a heap allocation in a string
+        Person person("a key longer than the small string buffer " + to_string(i), MINID + i, true);
+        cache.insert(person);
+        dataList.push_back(person);
+    }
+
+    for (size_t i = 0; i < dataList.size(); i++) {
+        string key = dataList[i].getKey();
+        PersonView view = cache.getPersonView(key, dataList[i].getID());
+        if (!view.getUsed() || view.getKey() != key || view.getID() != dataList[i].getID() ||
+            view.getKey().data() == key.data() || !(view.toPerson() == dataList[i])) {
+            result = false;
+        }
+        // misses: a different ID, an invalid ID
+        if (cache.getPersonView(key, dataList[i].getID() + 1000).getUsed() ||
+            cache.getPersonView(key, MINID - 1).getUsed() ||
+            cache.getPersonView(key, MINID - 1).toPerson().getUsed()) {
+            result = false;
+        }
+    }
+
+    // with shared reads the view refers to the key passed in
+    cache.setSharedReads(true);
+    string key = dataList[7].getKey();
+    PersonView view = cache.getPersonView(key, dataList[7].getID());
+    if (!view.getUsed() || view.getKey().data() != key.data()) {
+        result = false;
+    }
+
+    ShardedCache sharded(MINPRIME, hashCode, LINEAR, KEYHASH, 4);
+    sharded.insert(dataList[3]);
+    if (!sharded.getPersonView(dataList[3].getKey(), dataList[3].getID()).getUsed() ||
+        sharded.getPersonView(dataList[4].getKey(), dataList[4].getID()).getUsed()) {
+        result = false;
+    }
+    return result;
+}
+
+// Test 42: Test the common paths do not allocate with a string_view hash function:
+// lookups, removes and ID updates never, inserts only for a new key pool chunk now and then,
+// and the same for batch inserts and removes
+bool Tester::testNoAllocationPaths() {
+    const int COUNT = 2000;
+    Cache cache(COUNT * 4, hashCodeView, LINEAR);
+    bool result = true;
+    vector<string> keys;
+    vector<Person> people;
+    for (int i = 0; i < COUNT; i++) {
+        keys.push_back("a key too long for the small string buffer " + to_string(i));
+        people.push_back(Person(keys[i], MINID + i, true));
+    }
+
+    long before = allocations;
+    for (int i = 0; i < COUNT / 2; i++) {
+        cache.emplace(keys[i], MINID + i);
+    }
+    for (int i = COUNT / 2; i < COUNT; i++) {
+        cache.insert(people[i]);
+    }
+    long inserts = allocations - before;
+
+    before = allocations;
+    for (int i = 0; i < COUNT; i++) {
+        if (!cache.getPersonView(keys[i], MINID + i).getUsed()) {
+            result = false;
+        }
+    }
+    for (int i = 0; i < COUNT; i += 2) {
+        cache.updateID(people[i], MAXID - i);
+    }
+    for (int i = 1; i < COUNT; i += 2) {
+        cache.remove(keys[i], MINID + i);
+    }
+    long others = allocations - before;
+
+    // the key pool doubles its chunks, a handful of allocations for all the inserts
+    if (inserts > 20 || others != 0) {
+        result = false;
+    }
+
+    // the batches read the keys of the records in place as well, half of the
+    // records are removed, removing more would start a rehash
+    Cache batched(COUNT * 4, hashCodeView, LINEAR);
+    before = allocations;
+    batched.insertBatch(people.data(), COUNT);
+    inserts = allocations - before;
+    before = allocations;
+    int removed = batched.removeBatch(people.data(), COUNT / 2);
+    others = allocations - before;
+    if (inserts > 20 || others != 0 || removed != COUNT / 2) {
+        result = false;
+    }
+
+    // a hash function of the old signature gets a copy of every key
+    Cache copying(COUNT * 4, hashCode, LINEAR);
+    copying.emplace(keys[0], MINID);
+    before = allocations;
+    copying.getPersonView(keys[0], MINID);
+    if (allocations - before != 1) {
+        result = false;
+    }
+    return result;
+}
+
+// counts the calls of countingHash
+static long hashCalls = 0;
+// every key of the same length gets the same hash, so the probe chains are long
+unsigned int countingHash(string_view str) {
+    hashCalls++;
+    return static_cast<unsigned int>(str.length()) * 2654435761u;
+}
+
+// Test 43: Test every operation hashes its key exactly once, however long
+// the probe chain, through a rehash, and through a ShardedCache
+bool Tester::testHashOncePerOperation() {
+    const int COUNT = 60;
+    bool result = true;
+    prob_t policies[] = {QUADRATIC, DOUBLEHASH, LINEAR, SWISS, ROBINHOOD};
+    for (prob_t policy : policies) {
+        for (hash_t hashing : {KEYHASH, COMPOSITEHASH}) {
+            // small enough to rehash along the way
+            Cache cache(MINPRIME, countingHash, policy, hashing);
+            hashCalls = 0;
+            long ops = 0;
+            for (int i = 0; i < COUNT; i++) {
+                cache.emplace("key" + to_string(100 + i), MINID + i);
+                ops++;
+            }
+            for (int i = 0; i < COUNT; i++) {
+                if (!cache.getPerson("key" + to_string(100 + i), MINID + i).getUsed() ||
+                    !cache.getPersonView("key" + to_string(100 + i), MINID + i).getUsed()) {
+                    result = false;
+                }
+                ops += 2;
+            }
+            for (int i = 0; i < COUNT; i += 2) {
+                if (!cache.updateID(Person("key" + to_string(100 + i), MINID + i), MAXID - i)) {
+                    result = false;
+                }
+                ops++;
+            }
+            for (int i = 1; i < COUNT; i += 2) {
+                if (!cache.remove("key" + to_string(100 + i), MINID + i)) {
+                    result = false;
+                }
+                ops++;
+            }
+            if (hashCalls != ops) {
+                result = false;
+            }
+        }
+    }
+
+    // the shard is picked with the same hash the shard uses
+    ShardedCache sharded(MINPRIME * 4, countingHash, DOUBLEHASH, DEFHASH, 4);
+    hashCalls = 0;
+    for (int i = 0; i < COUNT; i++) {
+        sharded.emplace("key" + to_string(100 + i), MINID + i);
+        if (!sharded.getPerson("key" + to_string(100 + i), MINID + i).getUsed()) {
+            result = false;
+        }
+        sharded.remove("key" + to_string(100 + i), MINID + i);
+    }
+    if (hashCalls != COUNT * 3) {
+        result = false;
+    }
+    return result;
+}
+
+// Test 44: Test the single probe of an insert: a duplicate behind a deleted slot
+// is still found, the first deleted slot of the chain is reused, and a record
+// still waiting in the old table is not inserted a second time
+bool Tester::testSinglePassInsert() {
+    bool result = true;
+    prob_t policies[] = {QUADRATIC, DOUBLEHASH, LINEAR, SWISS, ROBINHOOD};
+    for (prob_t policy : policies) {
+        // every key of the same length is on the same probe chain
+        Cache cache(MINPRIME, countingHash, policy);
+        for (int i = 0; i < 10; i++) {
+            cache.emplace("key" + to_string(100 + i), MINID + i);
+        }
+        size_t first = cache.findRecord(cache.m_currentTable, cache.m_currentCtrl, cache.m_currentCap,
+                                        cache.m_currentMod, policy, cache.bucketHash("key100", MINID),
+                                        "key100", MINID);
+        cache.remove("key100", MINID);
+        for (int i = 1; i < 10; i++) {
+            if (cache.emplace("key" + to_string(100 + i), MINID + i)) {
+                result = false;     // duplicate behind the deleted slot
+            }
+        }
+        size_t deleted = cache.m_currNumDeleted;
+        if (!cache.emplace("key200", MINID)) {
+            result = false;
+        }
+        if (policy != ROBINHOOD) {
+            // the new record takes the deleted slot at the front of the chain
+            if (cache.m_currentTable[first].getKey() != "key200" || cache.m_currNumDeleted != deleted - 1) {
+                result = false;
+            }
+        }
+        for (int i = 1; i < 10; i++) {
+            if (!cache.getPerson("key" + to_string(100 + i), MINID + i).getUsed()) {
+                result = false;
+            }
+        }
+    }
+
+    // records not moved yet are found in the old table
+    Cache cache(MINPRIME, hashCodeView, QUADRATIC);
+    cache.setTransferBudget(1);
+    int count = 0;
+    while (cache.m_oldTable == nullptr) {
+        cache.emplace("record" + to_string(count), MINID + count);
+        count++;
+    }
+    for (int i = 0; i < count; i++) {
+        if (cache.emplace("record" + to_string(i), MINID + i)) {
+            result = false;
+        }
+    }
+    return result;
+}
+
+// Test 45: Test the hash functions of hashes.h: CRC32C gives its check value,
+// every function depends on the key bytes only, not on where they are stored,
+// sequential keys rarely collide (except for djb), and a Cache works with each one
+bool Tester::testHashLibrary() {
+    bool result = true;
+    if (crc32cHash("123456789") != 0xE3069283u || crc32cHash("") != 0) {
+        result = false;
+    }
+    if (findHashFunction("wyhash") != wyHash || findHashFunction("none") != nullptr) {
+        result = false;
+    }
+    // every length up to a few blocks, at an odd offset in a larger buffer
+    string buffer(200, 'x');
+    for (size_t len = 0; len <= 100; len++) {
+        string key;
+        for (size_t k = 0; k < len; k++) {
+            key += static_cast<char>('a' + (k * 7 + len) % 26);
+        }
+        buffer.replace(3, len, key);
+        for (int h = 0; h < NUMHASHFUNCTIONS; h++) {
+            hash_view_fn hash = HASHFUNCTIONS[h].m_hash;
+            if (hash(key) != hash(string_view(buffer.data() + 3, len))) {
+                result = false;
+            }
+        }
+    }
+    for (int h = 0; h < NUMHASHFUNCTIONS; h++) {
+        if (HASHFUNCTIONS[h].m_hash == djbHash) {
+            continue;
+        }
+        vector<unsigned int> values;
+        for (int i = 0; i < 10000; i++) {
+            values.push_back(HASHFUNCTIONS[h].m_hash("user" + to_string(i)));
+        }
+        sort(values.begin(), values.end());
+        int collisions = 0;
+        for (size_t i = 1; i < values.size(); i++) {
+            if (values[i] == values[i - 1]) {
+                collisions++;
+            }
+        }
+        // about 0.01 expected among 10000 random 32-bit values
+        if (collisions > 2) {
+            result = false;
+        }
+
+        Cache cache(MINPRIME, HASHFUNCTIONS[h].m_hash, SWISS);
+        for (int i = 0; i < 1000; i++) {
+            cache.emplace("user" + to_string(i), MINID + i);
+        }
+        for (int i = 0; i < 1000; i++) {
+            if (!cache.getPerson("user" + to_string(i), MINID + i).getUsed()) {
+                result = false;
+            }
+        }
+    }
+    return result;
+}
+
+// Test 46: Test analyze: five records on one probe chain have probe lengths 1 to 5
+// (one group for SWISS), a removed one shows as a deleted marker, and during a
+// rehash the records still in the old table are counted; both output formats are written
+bool Tester::testAnalyze() {
+    bool result = true;
+    prob_t policies[] = {QUADRATIC, DOUBLEHASH, LINEAR, SWISS, ROBINHOOD};
+    for (prob_t policy : policies) {
+        Cache cache(MINPRIME, countingHash, policy);
+        for (int i = 0; i < 5; i++) {
+            cache.emplace("key" + to_string(100 + i), MINID + i);
+        }
+        CacheStats stats = cache.analyze();
+        const TableStats& table = stats.m_current;
+        if (table.m_capacity != cache.m_currentCap || table.m_live != 5 || table.m_deleted != 0 ||
+            stats.m_old.m_capacity != 0 || stats.m_oldFraction != 0.0) {
+            result = false;
+        }
+        // the records sit next to each other unless the steps are longer
+        if (policy != QUADRATIC && policy != DOUBLEHASH && table.m_maxDisplacement != 4) {
+            result = false;
+        }
+        if (policy == SWISS) {
+            if (table.m_probeHistogram[0] != 5 || table.m_maxProbe != 1) {
+                result = false;
+            }
+        } else {
+            for (int k = 0; k < 5; k++) {
+                if (table.m_probeHistogram[k] != 1) {
+                    result = false;
+                }
+            }
+            if (table.m_maxProbe != 5 || table.m_averageProbe != 3.0) {
+                result = false;
+            }
+        }
+        if (policy == LINEAR && (table.m_clusters != 1 || table.m_maxCluster != 5 ||
+                                 table.m_clusterHistogram[2] != 1)) {
+            result = false;
+        }
+
+        cache.remove("key102", MINID + 2);
+        stats = cache.analyze();
+        double deleted = 0.0;
+        for (int k = 0; k < DENSITYREGIONS; k++) {
+            deleted += stats.m_current.m_regionDeleted[k];
+        }
+        if (policy == ROBINHOOD) {
+            // backward shift leaves no marker
+            if (stats.m_current.m_deleted != 0 || deleted != 0.0) {
+                result = false;
+            }
+        } else if (stats.m_current.m_deleted != 1 || deleted <= 0.0) {
+            result = false;
+        }
+    }
+
+    // in the middle of a rehash
+    Cache cache(MINPRIME, hashCodeView, QUADRATIC);
+    cache.setTransferBudget(1);
+    int count = 0;
+    while (cache.m_oldTable == nullptr) {
+        cache.emplace("record" + to_string(count), MINID + count);
+        count++;
+    }
+    CacheStats stats = cache.analyze();
+    if (stats.m_old.m_capacity != cache.m_oldCap || stats.m_old.m_live == 0 ||
+        stats.m_current.m_live + stats.m_old.m_live != static_cast<size_t>(count) ||
+        stats.m_oldFraction <= 0.0 || stats.m_oldFraction >= 1.0) {
+        result = false;
+    }
+    size_t histogram = 0;
+    for (int k = 0; k < PROBEBUCKETS; k++) {
+        histogram += stats.m_old.m_probeHistogram[k];
+    }
+    if (histogram != stats.m_old.m_live) {
+        result = false;
+    }
+
+    stringstream json;
+    cache.writeStats(json, STATSJSON);
+    string text = json.str();
+    if (text.front() != '{' || text.find("\"old\": {\"probing\": \"QUADRATIC\"") == string::npos ||
+        text.find("\"probe_histogram\": [") == string::npos) {
+        result = false;
+    }
+    stringstream csv;
+    cache.writeStats(csv, STATSCSV);
+    string line;
+    getline(csv, line);
+    if (line != "table,metric,bucket,value") {
+        result = false;
+    }
+    int rows = 0;
+    while (getline(csv, line)) {
+        rows++;
+        if (count_if(line.begin(), line.end(), [](char c) {return c == ',';}) != 3) {
+            result = false;
+        }
+    }
+    if (rows < 2 * (9 + DENSITYREGIONS)) {
+        result = false;
+    }
+    return result;
+}
+
+// Test 47: Test the metrics counters: lookups split into hits and misses, a reused
+// deleted slot, both rehash triggers, every migrated record, and the probes of a
+// collision chain; a ShardedCache adds the counters of its shards
+bool Tester::testMetrics() {
+    bool result = true;
+    Cache cache(MINPRIME, hashCodeView, LINEAR);
+    if (!cache.metrics().m_enabled) {
+        return true;    // compiled out, everything stays 0
+    }
+    // 51 records pass the load limit of 101 buckets
+    for (int i = 0; i < 51; i++) {
+        cache.emplace("record" + to_string(i), MINID + i);
+    }
+    cache.drainRehash(0);
+    CacheMetrics m = cache.metrics();
+    if (m.m_inserts != 51 || m.m_loadRehashes != 1 || m.m_deletedRehashes != 0 ||
+        m.m_migrated != 51 || m.m_searches < 51 || m.m_probes < m.m_searches) {
+        result = false;
+    }
+
+    cache.resetMetrics();
+    for (int i = 0; i < 10; i++) {
+        cache.getPerson("record" + to_string(i), MINID + i);
+        cache.getPersonView("missing" + to_string(i), MINID + i);
+    }
+    cache.remove("record0", MINID);
+    cache.emplace("record0", MINID);
+    cache.updateID(Person("record1", MINID + 1), MAXID);
+    m = cache.metrics();
+    if (m.m_lookups != 20 || m.m_hits != 10 || m.m_misses != 10 || m.m_removes != 1 ||
+        m.m_inserts != 1 || m.m_updates != 1 || m.m_tombstoneReuses != 1) {
+        result = false;
+    }
+
+    // removing most records starts a rehash by the deleted ratio
+    Cache churn(MINPRIME, hashCodeView, QUADRATIC);
+    for (int i = 0; i < 45; i++) {
+        churn.emplace("record" + to_string(i), MINID + i);
+    }
+    for (int i = 0; i < 45; i++) {
+        churn.remove("record" + to_string(i), MINID + i);
+    }
+    if (churn.metrics().m_deletedRehashes == 0 || churn.metrics().m_loadRehashes != 0) {
+        result = false;
+    }
+
+    // five records on one chain: 1 + 2 + 3 + 4 + 5 buckets to find them all
+    Cache chain(MINPRIME, countingHash, LINEAR);
+    for (int i = 0; i < 5; i++) {
+        chain.emplace("key" + to_string(100 + i), MINID + i);
+    }
+    chain.resetMetrics();
+    for (int i = 0; i < 5; i++) {
+        chain.getPerson("key" + to_string(100 + i), MINID + i);
+    }
+    if (chain.metrics().m_probes != 15 || chain.metrics().m_searches != 5) {
+        result = false;
+    }
+
+    ShardedCache sharded(MINPRIME * 8, hashCodeView, QUADRATIC, DEFHASH, 8);
+    for (int i = 0; i < 200; i++) {
+        sharded.emplace("record" + to_string(i), MINID + i);
+        sharded.getPerson("record" + to_string(i), MINID + i);
+    }
+    m = sharded.metrics();
+    if (m.m_inserts != 200 || m.m_hits != 200) {
+        result = false;
+    }
+    return result;
+}
+
+// Test 48: Test the latency histograms: a bucket holds times within 1/16 of each
+// other, percentiles of known times, nothing is timed until tracking is on, every
+// operation lands in its histogram and only the ones that did rehash work in the
+// migration histogram; both output formats are written and a ShardedCache sums its shards
+bool Tester::testLatency() {
+    bool result = true;
+    // every time fits in the bucket it is put in, and buckets go up with the time
+    int last = -1;
+    for (uint64_t t = 0; t < (static_cast<uint64_t>(1) << 40); t = t + 1 + t / 7) {
+        int bucket = LatencyHistogram::bucketOf(t);
+        uint64_t top = LatencyHistogram::bucketTop(bucket);
+        if (bucket < last || bucket >= LATENCYBUCKETS || top < t || top > t + t / 16) {
+            result = false;
+        }
+        last = bucket;
+    }
+    if (LatencyHistogram::bucketOf(static_cast<uint64_t>(1) << 50) != LATENCYBUCKETS - 1) {
+        result = false;
+    }
+
+    // the times 1 to 1000
+    LatencyHistogram histogram;
+    for (uint64_t t = 1; t <= 1000; t++) {
+        histogram.record(t);
+    }
+    LatencySummary s = histogram.summary();
+    if (s.m_count != 1000 || s.m_mean != 500.5 || s.m_max != 1000 ||
+        s.m_p50 < 500 || s.m_p50 > 500 + 500 / 16 || s.m_p99 < 990 || s.m_p99 > 1000 ||
+        histogram.percentile(1.0) != 1000 || histogram.percentile(0.0) != 1) {
+        result = false;
+    }
+    histogram.reset();
+    if (histogram.count() != 0 || histogram.percentile(0.5) != 0) {
+        result = false;
+    }
+
+    Cache cache(MINPRIME, hashCodeView, LINEAR);
+    cache.emplace("untimed", MINID);
+    cache.setLatencyTracking(true);
+#ifdef CACHE_NO_LATENCY
+    if (cache.latency(OPINSERT).m_count != 0) {
+        result = false;
+    }
+    return result;      // compiled out, nothing is timed
+#endif
+    if (cache.latency(OPINSERT).m_count != 0) {
+        result = false;
+    }
+    // 30 records fit in 101 buckets, no rehash work yet
+    for (int i = 0; i < 30; i++) {
+        cache.emplace("record" + to_string(i), MINID + i);
+        cache.getPerson("record" + to_string(i), MINID + i);
+        cache.getPersonView("missing" + to_string(i), MINID + i);
+    }
+    cache.remove("record0", MINID);
+    cache.updateID(Person("record1", MINID + 1), MAXID);
+    Person batch[2] = {Person("record2", MINID + 2), Person("record3", MINID + 3)};
+    Person found[2];
+    cache.getPersonBatch(batch, 2, found);
+    if (cache.latency(OPINSERT).m_count != 30 || cache.latency(OPLOOKUP).m_count != 60 ||
+        cache.latency(OPREMOVE).m_count != 1 || cache.latency(OPUPDATE).m_count != 1 ||
+        cache.latency(OPMIGRATION).m_count != 0) {
+        result = false;
+    }
+    // passing the load limit starts a rehash, the operations that move the
+    // old table afterwards are timed a second time
+    for (int i = 30; i < 60; i++) {
+        cache.emplace("record" + to_string(i), MINID + i);
+    }
+    LatencySummary migration = cache.latency(OPMIGRATION);
+    if (migration.m_count == 0 || migration.m_count > 30 ||
+        migration.m_max > cache.latency(OPINSERT).m_max) {
+        result = false;
+    }
+
+    ostringstream json;
+    cache.writeLatency(json, STATSJSON);
+    if (json.str().find("\"migration\": {\"count\": " + to_string(migration.m_count)) == string::npos ||
+        json.str().find("\"insert\": {\"count\": 60") == string::npos) {
+        result = false;
+    }
+    ostringstream csv;
+    cache.writeLatency(csv, STATSCSV);
+    if (csv.str().find("operation,metric,value\ninsert,count,60\n") != 0 ||
+        csv.str().find("\nupdate,count,1\n") == string::npos) {
+        result = false;
+    }
+
+    // turned off the times are kept, reset drops them
+    cache.setLatencyTracking(false);
+    cache.emplace("record99", MINID + 99);
+    if (cache.latency(OPINSERT).m_count != 60) {
+        result = false;
+    }
+    cache.resetLatency();
+    if (cache.latency(OPINSERT).m_count != 0 || cache.latency(OPMIGRATION).m_count != 0) {
+        result = false;
+    }
+
+    ShardedCache sharded(MINPRIME * 8, hashCodeView, QUADRATIC, DEFHASH, 8);
+    sharded.setLatencyTracking(true);
+    for (int i = 0; i < 200; i++) {
+        sharded.emplace("record" + to_string(i), MINID + i);
+        sharded.getPerson("record" + to_string(i), MINID + i);
+    }
+    if (sharded.latency(OPINSERT).m_count != 200 || sharded.latency(OPLOOKUP).m_count != 200) {
+        result = false;
+    }
+    sharded.resetLatency();
+    if (sharded.latency(OPINSERT).m_count != 0) {
+        result = false;
+    }
+    return result;
+}
+
+// Test 49: Test trace recording: every operation of a cache, batches one record at a
+// time, is written with its key, IDs and a rising time, keys with spaces read back
+// whole, replaying the trace builds the same records, and broken lines are rejected
+bool Tester::testTrace() {
+    bool result = true;
+    ostringstream out;
+    TraceRecorder recorder(out);
+    Cache cache(MINPRIME, hashCodeView, LINEAR);
+    cache.setTraceRecorder(&recorder);
+    for (int i = 0; i < 60; i++) {
+        cache.emplace("record " + to_string(i), MINID + i);
+    }
+    cache.getPerson("record 1", MINID + 1);
+    cache.getPersonView("missing", MINID);
+    cache.remove("record 2", MINID + 2);
+    cache.updateID(Person("record 3", MINID + 3), MAXID);
+    Person batch[2] = {Person("batch0", MINID), Person("batch1", MINID + 1)};
+    cache.insertBatch(batch, 2);
+    cache.removeBatch(batch, 1);
+    cache.setTraceRecorder(nullptr);
+    cache.emplace("not recorded", MINID);
+    if (recorder.count() != 67) {
+        result = false;
+    }
+
+    istringstream in(out.str());
+    vector<TraceRecord> records;
+    if (!readTrace(in, records) || records.size() != 67) {
+        return false;
+    }
+    for (size_t i = 1; i < records.size(); i++) {
+        if (records[i].m_nanos < records[i - 1].m_nanos) {
+            result = false;
+        }
+    }
+    if (records[0].m_op != OPINSERT || records[0].m_key != "record 0" || records[0].m_id != MINID ||
+        records[60].m_op != OPLOOKUP || records[61].m_key != "missing" ||
+        records[62].m_op != OPREMOVE || records[62].m_id != MINID + 2 ||
+        records[63].m_op != OPUPDATE || records[63].m_id != MINID + 3 || records[63].m_newID != MAXID ||
+        records[64].m_key != "batch0" || records[66].m_op != OPREMOVE) {
+        result = false;
+    }
+
+    // the replay ends with the same records as the recorded cache
+    Cache copy(MINPRIME, hashCodeView, SWISS);
+    for (const TraceRecord& record : records) {
+        switch (record.m_op) {
+        case OPINSERT: copy.emplace(record.m_key, record.m_id); break;
+        case OPREMOVE: copy.remove(record.m_key, record.m_id); break;
+        case OPUPDATE: copy.updateID(Person(record.m_key, record.m_id), record.m_newID); break;
+        default: copy.getPerson(record.m_key, record.m_id); break;
+        }
+    }
+    if (!copy.getPerson("record 3", MAXID).getUsed() || copy.getPerson("record 2", MINID + 2).getUsed() ||
+        !copy.getPerson("batch1", MINID + 1).getUsed() || copy.getPerson("batch0", MINID).getUsed() ||
+        !copy.getPerson("record 59", MINID + 59).getUsed()) {
+        result = false;
+    }
+
+    // a ShardedCache records through its shards
+    ostringstream shardedOut;
+    TraceRecorder shardedRecorder(shardedOut);
+    ShardedCache sharded(MINPRIME * 4, hashCodeView, QUADRATIC, DEFHASH, 4);
+    sharded.setTraceRecorder(&shardedRecorder);
+    for (int i = 0; i < 20; i++) {
+        sharded.emplace("record" + to_string(i), MINID + i);
+    }
+    sharded.setTraceRecorder(nullptr);
+    if (shardedRecorder.count() != 20) {
+        result = false;
+    }
+
+    // a line cut short and an unknown operation
+    vector<TraceRecord> broken;
+    istringstream shortKey("10 I 100000 0 8 abc\n");
+    istringstream badOp("10 X 100000 0 3 abc\n");
+    if (readTrace(shortKey, broken) || readTrace(badOp, broken)) {
+        result = false;
+    }
+    return result;
+}
+
+// Test 50: Test the key handoff of a rehash: moved records keep their key bytes at the
+// same address and the new table takes the old key chunks over; when most of the old
+// key bytes belong to removed records the keys are copied into a smaller pool instead
+bool Tester::testKeyHandoff() {
+    bool result = true;
+    prob_t policies[] = {QUADRATIC, DOUBLEHASH, LINEAR, SWISS, ROBINHOOD};
+    for (prob_t policy : policies) {
+        Cache cache(MINPRIME, hashCodeView, policy);
+        int count = 0;
+        while (!cache.isRehashing()) {
+            cache.emplace("handoff record" + to_string(count), MINID + count);
+            count++;
+        }
+        string key = "handoff record0";
+        uint64_t before = cache.findSlot(cache.bucketHash(key, MINID), key, MINID)->m_key;
+        size_t oldBytes = cache.m_oldKeys->bytes();
+        if (!cache.m_handoffKeys) {
+            result = false;
+        }
+        cache.drainRehash(0);
+        const Slot* after = cache.findSlot(cache.bucketHash(key, MINID), key, MINID);
+        if (after == nullptr || after->m_key != before || cache.m_oldKeys != nullptr ||
+            cache.m_currentKeys->bytes() < oldBytes) {
+            result = false;
+        }
+        for (int i = 0; i < count; i++) {
+            if (!(cache.getPerson("handoff record" + to_string(i), MINID + i) ==
+                  Person("handoff record" + to_string(i), MINID + i))) {
+                result = false;
+            }
+        }
+
+        // 45 of 50 long keys removed: the deleted ratio starts a rehash that copies
+        Cache churn(MINPRIME, hashCodeView, policy);
+        for (int i = 0; i < 50; i++) {
+            churn.emplace("a rather long key for record " + to_string(i), MINID + i);
+        }
+        key = "a rather long key for record 49";
+        before = churn.findSlot(churn.bucketHash(key, MINID + 49), key, MINID + 49)->m_key;
+        size_t churnBytes = churn.m_currentKeys->bytes();
+        for (int i = 0; i < 45; i++) {
+            churn.remove("a rather long key for record " + to_string(i), MINID + i);
+        }
+        churn.drainRehash(0);
+        after = churn.findSlot(churn.bucketHash(key, MINID + 49), key, MINID + 49);
+        if (policy != ROBINHOOD) {
+            // ROBINHOOD has no deleted markers, its removes start no rehash
+            if (after == nullptr || after->m_key == before || churn.m_currentKeys->bytes() >= churnBytes) {
+                result = false;
+            }
+        } else if (after == nullptr) {
+            result = false;
+        }
+    }
+    return result;
+}
+
+// Test 51: Test that moving records to the new table allocates nothing: with the key
+// handoff a rehash only writes slots, whatever the number of records, and the records
+// are found after the last pass, which leaves no deleted markers behind
+bool Tester::testMigrationAllocations() {
+    bool result = true;
+    prob_t policies[] = {QUADRATIC, DOUBLEHASH, LINEAR, SWISS, ROBINHOOD};
+    for (prob_t policy : policies) {
+        Cache cache(MINPRIME, hashCodeView, policy);
+        int count = 0;
+        while (count < 2000 || !cache.isRehashing()) {
+            cache.emplace("record" + to_string(count), MINID + count);
+            count++;
+        }
+        // one bucket, then the rest; the only allocation may be the chunk
+        // list of the new key pool growing to take the old chunks
+        long before = allocations;
+        cache.drainRehash(1);
+        cache.drainRehash(0);
+        if (allocations - before > 1 || cache.isRehashing()) {
+            result = false;
+        }
+        for (int i = 0; i < count; i++) {
+            if (!cache.getPerson("record" + to_string(i), MINID + i).getUsed()) {
+                result = false;
+            }
+        }
+    }
+    return result;
+}
+
+// Test 52: Test the 16-byte slots: keys of up to INLINEKEY bytes take no key pool bytes,
+// keys at the length boundaries and keys longer than LONGKEY are found, also by shared
+// reads and after a rehash, and memoryUsage adds up the tables and key pools
+bool Tester::testCompactSlots() {
+    bool result = sizeof(Slot) == 16;
+    string lengths[] = {"", "a", "eightchr", "ninechars", string(LONGKEY - 1, 'x'),
+                        string(LONGKEY, 'x'), string(LONGKEY + 1, 'x'), string(3 * LONGKEY, 'y')};
+    prob_t policies[] = {QUADRATIC, DOUBLEHASH, LINEAR, SWISS, ROBINHOOD};
+    for (prob_t policy : policies) {
+        // only short keys: the key pool stays empty
+        Cache shortKeys(MINPRIME, hashCodeView, policy);
+        for (int i = 0; i < 200; i++) {
+            shortKeys.emplace("k" + to_string(i), MINID + i);
+        }
+        shortKeys.drainRehash(0);
+        CacheMemory memory = shortKeys.memoryUsage();
+        if (memory.m_keyUsed != 0 || memory.m_records != 200 ||
+            memory.m_slotBytes != shortKeys.m_currentCap * sizeof(Slot) ||
+            memory.m_totalBytes != memory.m_slotBytes + memory.m_ctrlBytes + memory.m_keyBytes ||
+            memory.m_bytesPerRecord * 200 != static_cast<double>(memory.m_totalBytes)) {
+            result = false;
+        }
+        for (int i = 0; i < 200; i++) {
+            PersonView view = shortKeys.getPersonView("k" + to_string(i), MINID + i);
+            if (!view.getUsed() || view.getKey() != "k" + to_string(i)) {
+                result = false;
+            }
+        }
+
+        // keys around INLINEKEY and LONGKEY, a key and its prefix never match
+        Cache cache(MINPRIME, hashCodeView, policy);
+        for (int round = 0; round < 2; round++) {
+            for (int i = 0; i < 8; i++) {
+                if (!cache.emplace(lengths[i], MINID + i)) {
+                    result = false;
+                }
+            }
+            for (int i = 0; i < 8; i++) {
+                const Slot* slot = cache.findSlot(cache.bucketHash(lengths[i], MINID + i), lengths[i], MINID + i);
+                if (slot == nullptr || slot->getKey() != lengths[i] || slot->getID() != MINID + i ||
+                    cache.getPersonView(lengths[i] + "x", MINID + i).getUsed()) {
+                    result = false;
+                }
+            }
+            if (!cache.updateID(Person(lengths[6], MINID + 6), MAXID) ||
+                !(cache.getPerson(lengths[6], MAXID) == Person(lengths[6], MAXID)) ||
+                !cache.updateID(Person(lengths[6], MAXID), MINID + 6)) {
+                result = false;
+            }
+            // the second round reuses the slots the removes leave behind
+            for (int i = 0; i < 8 && round == 0; i++) {
+                if (!cache.remove(lengths[i], MINID + i)) {
+                    result = false;
+                }
+            }
+        }
+        // a rehash moves short keys by value and long keys by pointer
+        for (int i = 0; !cache.isRehashing(); i++) {
+            cache.emplace("filler" + to_string(i), MINID + 100 + i);
+        }
+        cache.setSharedReads(true);
+        for (int i = 0; i < 8; i++) {
+            if (!cache.getPersonView(lengths[i], MINID + i).getUsed()) {
+                result = false;
+            }
+        }
+        cache.drainRehash(0);
+        for (int i = 0; i < 8; i++) {
+            if (!(cache.getPerson(lengths[i], MINID + i) == Person(lengths[i], MINID + i))) {
+                result = false;
+            }
+        }
+        cache.setSharedReads(false);
+    }
+
+    // the shards add up
+    ShardedCache sharded(MINPRIME * 8, hashCodeView, LINEAR, KEYHASH, 8);
+    for (int i = 0; i < 500; i++) {
+        sharded.emplace("sharded record " + to_string(i), MINID + i);
+    }
+    CacheMemory total = sharded.memoryUsage();
+    if (total.m_records != sharded.size() || total.m_keyUsed < 500 * 15 ||
+        total.m_bytesPerRecord <= 0.0) {
+        result = false;
+    }
+    return result;
+}
+
+// Test 53: Test that a COMPOSITEHASH updateID whose insert fails keeps the record:
+// with every free bucket of the table taken the record cannot move to the home
+// bucket of its new ID, and it has to stay where it is under its old ID
+bool Tester::testUpdateIDMoveFailure() {
+    bool result = true;
+    prob_t policies[] = {QUADRATIC, DOUBLEHASH, LINEAR, SWISS, ROBINHOOD};
+    for (prob_t policy : policies) {
+        Cache cache(MINPRIME, hashCodeView, policy, COMPOSITEHASH);
+        for (int i = 0; i < 20; i++) {
+            cache.emplace(searchStr[i % 8], MINID + i);
+        }
+        // the free buckets look live to the probes, their slots match no record
+        vector<size_t> taken;
+        for (size_t j = 0; j < cache.m_currentCap; j++) {
+            if (!isLive(cache.m_currentCtrl[j])) {
+                taken.push_back(j);
+                cache.setCtrl(cache.m_currentCtrl, cache.m_currentCap, j, 0x01);
+            }
+        }
+        if (cache.updateID(Person(searchStr[3], MINID + 3), MAXID) ||
+            !(cache.getPerson(searchStr[3], MINID + 3) == Person(searchStr[3], MINID + 3)) ||
+            cache.getPerson(searchStr[3], MAXID).getUsed()) {
+            result = false;
+        }
+        for (size_t j : taken) {
+            cache.setCtrl(cache.m_currentCtrl, cache.m_currentCap, j, EMPTY);
+        }
+
+        // with room again the move goes through and the record is only under its new ID
+        if (!cache.updateID(Person(searchStr[3], MINID + 3), MAXID) ||
+            cache.getPerson(searchStr[3], MINID + 3).getUsed() ||
+            !(cache.getPerson(searchStr[3], MAXID) == Person(searchStr[3], MAXID))) {
+            result = false;
+        }
+    }
+    return result;
+}
+
+// Test 54: Test ShardedCache with COMPOSITEHASH: a few keys with many IDs each use all
+// the shards, where KEYHASH puts each key on one shard; updateID moves records between
+// shards, also from several threads at once in both directions, without losing any
+bool Tester::testShardedCompositeHash() {
+    const int SHARDS = 16;
+    const int KEYS = 8;
+    const int IDS = 200;
+    const int MOVE = 400000;    // added to an ID by the moves
+    ShardedCache composite(MINPRIME * SHARDS, hashCodeView, LINEAR, COMPOSITEHASH, SHARDS);
+    ShardedCache byKey(MINPRIME * SHARDS, hashCodeView, LINEAR, KEYHASH, SHARDS);
+    bool result = true;
+    for (int k = 0; k < KEYS; k++) {
+        for (int i = 0; i < IDS; i++) {
+            composite.emplace(searchStr[k], MINID + i);
+            byKey.emplace(searchStr[k], MINID + i);
+        }
+    }
+    int usedComposite = 0;
+    int usedByKey = 0;
+    for (int s = 0; s < SHARDS; s++) {
+        usedComposite += (composite.m_shards[s].m_size > 0) ? 1 : 0;
+        usedByKey += (byKey.m_shards[s].m_size > 0) ? 1 : 0;
+    }
+    if (usedComposite != SHARDS || usedByKey > KEYS) {
+        result = false;
+    }
+
+    // moves to an existing record, of a missing record and to a bad ID fail
+    if (composite.updateID(Person(searchStr[0], MINID), MINID + 1) ||
+        composite.updateID(Person(searchStr[0], MAXID), MINID + MOVE) ||
+        composite.updateID(Person(searchStr[0], MINID), MAXID + 1) ||
+        !composite.getPerson(searchStr[0], MINID).getUsed() ||
+        !composite.getPerson(searchStr[0], MINID + 1).getUsed()) {
+        result = false;
+    }
+
+    // every thread moves the records of its key up and back down, moves of different
+    // threads lock the same pairs of shards in both directions
+    atomic<bool> failed(false);
+    atomic<int> crossShard(0);
+    vector<thread> threads;
+    for (int k = 0; k < KEYS; k++) {
+        threads.push_back(thread([&composite, &failed, &crossShard, k]() {
+            unsigned int h = composite.keyHash(searchStr[k]);
+            for (int round = 0; round < 4; round++) {
+                int from = (round % 2 == 0) ? 0 : MOVE;
+                int to = MOVE - from;
+                for (int i = 0; i < IDS; i++) {
+                    if (&composite.shardOf(h, MINID + from + i) != &composite.shardOf(h, MINID + to + i)) {
+                        crossShard++;
+                    }
+                    if (!composite.updateID(Person(searchStr[k], MINID + from + i), MINID + to + i)) {
+                        failed = true;
+                    }
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    if (failed || crossShard == 0 || composite.size() != static_cast<size_t>(KEYS * IDS) ||
+        composite.memoryUsage().m_records != composite.size()) {
+        result = false;
+    }
+    for (int k = 0; k < KEYS; k++) {
+        for (int i = 0; i < IDS; i++) {
+            if (!composite.getPerson(searchStr[k], MINID + i).getUsed() ||
+                composite.getPerson(searchStr[k], MINID + MOVE + i).getUsed()) {
+                result = false;
+            }
+        }
+    }
+    return result;
+}
+
+// Test 55: Test a Cache built with a negative size, which wraps to a huge size_t,
+// starts at MINPRIME, an absurd size starts at the capped capacity, and both work
+bool Tester::testConstructorSizeClamp() {
+    bool result = true;
+    Cache negative(-1, hashCode, LINEAR);
+    Cache wrapped(static_cast<size_t>(-MINPRIME), hashCode, DOUBLEHASH);
+    if (negative.m_currentCap != MINPRIME || wrapped.m_currentCap != MINPRIME) {
+        result = false;
+    }
+    Cache absurd(MAXINITCAP * 1000, hashCode, LINEAR);
+    if (absurd.m_currentCap < MAXINITCAP || absurd.m_currentCap > MAXINITCAP * 2) {
+        result = false;
+    }
+    for (int i = 0; i < 1000; i++) {
+        negative.insert(Person(searchStr[i % 8], MINID + i));
+        absurd.insert(Person(searchStr[i % 8], MINID + i));
+    }
+    for (int i = 0; i < 1000; i++) {
+        if (!negative.getPerson(searchStr[i % 8], MINID + i).getUsed() ||
+            !absurd.getPerson(searchStr[i % 8], MINID + i).getUsed()) {
+            result = false;
+        }
+    }
+    return result;
+}
+
+int main() {
+    Tester tester;
+
+    cout << "Testing Cache Class" << endl;
+    cout << "===================" << endl << endl;
+
+    // Test 1: Insert non-colliding keys
+    cout << "Test 1: Insert with non-colliding keys (50 nodes): ";
+    if (tester.testInsertNonColliding()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 2: Insert colliding keys
+    cout << "Test 2: Insert with colliding keys (50 nodes): ";
+    if (tester.testInsertColliding()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 3: getPerson error case
+    cout << "Test 3: getPerson for non-existent person: ";
+    if (tester.testGetPersonNotFound()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 4: getPerson with non-colliding keys
+    cout << "Test 4: getPerson with non-colliding keys: ";
+    if (tester.testGetPersonNonColliding()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 5: getPerson with colliding keys
+    cout << "Test 5: getPerson with colliding keys (no rehash): ";
+    if (tester.testGetPersonColliding()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 6: Remove non-colliding keys
+    cout << "Test 6: Remove with non-colliding keys: ";
+    if (tester.testRemoveNonColliding()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 7: Remove colliding keys
+    cout << "Test 7: Remove with colliding keys (no rehash): ";
+    if (tester.testRemoveColliding()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 8: Rehash triggered by insertion
+    cout << "Test 8: Rehash triggered by insertion (load factor): ";
+    if (tester.testRehashTriggeredByInsertion()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 9: Rehash completion after insertion
+    cout << "Test 9: Rehash completion after load factor trigger: ";
+    if (tester.testRehashCompletionAfterInsertion()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 10: Rehash triggered by removal
+    cout << "Test 10: Rehash triggered by removal (delete ratio): ";
+    if (tester.testRehashTriggeredByRemoval()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 11: Rehash completion after removal
+    cout << "Test 11: Rehash completion after delete ratio trigger: ";
+    if (tester.testRehashCompletionAfterRemoval()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 12: updateID normal case
+    cout << "Test 12: updateID normal case: ";
+    if (tester.testUpdateIDNormal()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 13: updateID error case
+    cout << "Test 13: updateID error cases (invalid ID): ";
+    if (tester.testUpdateIDError()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 14: Insert with invalid ID below MINID
+    cout << "Test 14: Insert with invalid ID (below MINID): ";
+    if (tester.testInsertInvalidIDBelowMin()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 15: Insert with invalid ID above MAXID
+    cout << "Test 15: Insert with invalid ID (above MAXID): ";
+    if (tester.testInsertInvalidIDAboveMax()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 16: Remove non-existent person
+    cout << "Test 16: Remove non-existent person: ";
+    if (tester.testRemoveNonExistent()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 17: Duplicate insertion prevention
+    cout << "Test 17: Duplicate insertion prevention: ";
+    if (tester.testDuplicatePrevention()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 18: Probing policy change
+    cout << "Test 18: Probing policy change: ";
+    if (tester.testProbingPolicyChange()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 19: Linear probing
+    cout << "Test 19: Linear probing with collisions: ";
+    if (tester.testLinearProbing()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 20: Quadratic probing
+    cout << "Test 20: Quadratic probing with collisions: ";
+    if (tester.testQuadraticProbing()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 21: Lambda and deletedRatio calculations
     cout << "Test 21: Lambda and deletedRatio calculations: ";
     if (tester.testLambdaAndDeletedRatio()) {
         cout << "PASSED" << endl;
@@ -1002,6 +2942,278 @@ int main() {
         cout << "FAILED" << endl;
     }
 
+    // Test 22: Composite hashing spread
+    cout << "Test 22: Composite hashing spreads same-key records: ";
+    if (tester.testCompositeHashSpread()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 23: Composite hashing with skewed keys
+    cout << "Test 23: Composite hashing with skewed keys: ";
+    if (tester.testCompositeHashSkewedKeys()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 24: Composite hashing updateID
+    cout << "Test 24: updateID with composite hashing: ";
+    if (tester.testCompositeHashUpdateID()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 25: Stored hashes through a rehash
+    cout << "Test 25: Stored slot hashes through a rehash: ";
+    if (tester.testStoredHashAfterRehash()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 26: SWISS probing with collisions
+    cout << "Test 26: SWISS group probing with collisions: ";
+    if (tester.testSwissProbingColliding()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 27: SWISS probing at high load
+    cout << "Test 27: SWISS group probing at high load: ";
+    if (tester.testSwissHighLoad()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 28: Policy change to and from SWISS
+    cout << "Test 28: Policy change to and from SWISS: ";
+    if (tester.testSwissPolicyChange()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 29: ROBINHOOD churn
+    cout << "Test 29: ROBINHOOD insert/remove churn without deleted markers: ";
+    if (tester.testRobinHoodChurn()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 30: ROBINHOOD invariant
+    cout << "Test 30: ROBINHOOD probe distances after churn: ";
+    if (tester.testRobinHoodInvariant()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 31: ROBINHOOD old table remove
+    cout << "Test 31: Remove from an old ROBINHOOD table: ";
+    if (tester.testRobinHoodOldTableRemove()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 32: Large capacity
+    cout << "Test 32: Table grows past 99991 buckets (200000 records): ";
+    if (tester.testLargeCapacity()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 33: Prime ladder capacities
+    cout << "Test 33: Capacities from the prime ladder: ";
+    if (tester.testPrimeLadderCapacity()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 34: Bounded transfer budget
+    cout << "Test 34: Rehash work per insert is bounded: ";
+    if (tester.testTransferBudget()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 35: Draining a rehash
+    cout << "Test 35: drainRehash completes a rehash: ";
+    if (tester.testDrainRehash()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 36: Background migrator with lookups only
+    cout << "Test 36: Background rehash finishes under concurrent lookups: ";
+    if (tester.testBackgroundRehashReads()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 37: Background migrator with writes
+    cout << "Test 37: Writes stay correct with the background migrator: ";
+    if (tester.testBackgroundRehashWrites()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 38: Sharded cache with threads
+    cout << "Test 38: ShardedCache with concurrent readers and writers: ";
+    if (tester.testShardedCacheThreads()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 39: Lock-free lookups racing a writer
+    cout << "Test 39: Lookups on many threads racing one writer: ";
+    if (tester.testSharedReadsStress()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 40: Batch operations
+    cout << "Test 40: Batch lookups, inserts and removes: ";
+    if (tester.testBatchOperations()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 41: Lookup views
+    cout << "Test 41: getPersonView without copies: ";
+    if (tester.testPersonView()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 42: Allocation free paths
+    cout << "Test 42: No allocations on the common paths: ";
+    if (tester.testNoAllocationPaths()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 43: One hash per operation
+    cout << "Test 43: Keys are hashed once per operation: ";
+    if (tester.testHashOncePerOperation()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 44: Fused duplicate check and placement
+    cout << "Test 44: Insert checks duplicates and places in one probe: ";
+    if (tester.testSinglePassInsert()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 45: Hash function library
+    cout << "Test 45: Library hash functions: ";
+    if (tester.testHashLibrary()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 46: Table analysis
+    cout << "Test 46: analyze reports probe lengths, clusters and deleted markers: ";
+    if (tester.testAnalyze()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 47: Metrics counters
+    cout << "Test 47: Metrics counters follow the operations: ";
+    if (tester.testMetrics()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 48: Latency histograms
+    cout << "Test 48: Latency histograms time every operation: ";
+    if (tester.testLatency()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 49: Trace recording
+    cout << "Test 49: Traces record every operation and read back: ";
+    if (tester.testTrace()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 50: Key handoff
+    cout << "Test 50: Rehash hands key bytes over instead of copying them: ";
+    if (tester.testKeyHandoff()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 51: Migration without allocations
+    cout << "Test 51: Moving records to the new table allocates nothing: ";
+    if (tester.testMigrationAllocations()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 52: Compact slots
+    cout << "Test 52: Short keys live in the slot, memory usage adds up: ";
+    if (tester.testCompactSlots()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 53: updateID move failure
+    cout << "Test 53: A COMPOSITEHASH updateID that cannot insert keeps the record: ";
+    if (tester.testUpdateIDMoveFailure()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 54: ShardedCache with composite hashing
+    cout << "Test 54: ShardedCache COMPOSITEHASH spreads keys and moves records between shards: ";
+    if (tester.testShardedCompositeHash()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
+    // Test 55: Constructor size clamp
+    cout << "Test 55: Cache with a negative or absurd size gets a usable table: ";
+    if (tester.testConstructorSizeClamp()) {
+        cout << "PASSED" << endl;
+    } else {
+        cout << "FAILED" << endl;
+    }
+
     cout << endl << "All tests completed." << endl;
 
     return 0;
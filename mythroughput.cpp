@@ -0,0 +1,187 @@
+// CMSC 341 - Fall 2025 - Project 4
+// mythroughput.cpp - Multi-threaded throughput test for ShardedCache
+// build: g++ -std=c++17 -O2 -pthread cache.cpp shardedcache.cpp mythroughput.cpp -o mythroughput
+// usage: ./mythroughput [max threads] [operations per thread]
+#include "shardedcache.h"
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+using namespace std;
+
+const int PRELOAD = 200000;     // records in the cache before the timed run
+const int READPERCENT = 90;     // the rest is split between inserts and removes
+// the key set of the skewed run, as in mytest: a handful of keys with many IDs each
+const int NUMSKEWED = 8;
+const string SKEWEDKEYS[NUMSKEWED] = {"c++", "python", "java", "scheme", "prolog", "c#", "c", "js"};
+
+// Hash function
+unsigned int hashCode(const string str) {
+    unsigned int val = 0;
+    const unsigned int thirtyThree = 33;
+    for (int i = 0; i < (int)(str.length()); i++)
+        val = val * thirtyThree + str[i];
+    return val;
+}
+
+// small per-thread generator, cheaper than mt19937 in the timed loop
+class XorShift {
+public:
+    XorShift(unsigned long long seed) : m_state(seed * 0x9e3779b97f4a7c15ULL + 1) {}
+    unsigned int next() {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return static_cast<unsigned int>(m_state >> 32);
+    }
+private:
+    unsigned long long m_state;
+};
+
+// the baseline the sharded cache is compared with: one Cache behind one mutex
+class LockedCache {
+public:
+    LockedCache(size_t size, hash_t hashing) : m_cache(size, hashCode, QUADRATIC, hashing) {}
+    bool insert(Person person) {
+        lock_guard<mutex> lock(m_lock);
+        return m_cache.insert(person);
+    }
+    bool remove(Person person) {
+        lock_guard<mutex> lock(m_lock);
+        return m_cache.remove(person);
+    }
+    const Person getPerson(string key, int id) {
+        lock_guard<mutex> lock(m_lock);
+        return m_cache.getPerson(key, id);
+    }
+private:
+    mutex m_lock;
+    Cache m_cache;
+};
+
+// in the skewed run the preloaded records share NUMSKEWED keys
+string presetKey(int i, bool skewed) {
+    return skewed ? SKEWEDKEYS[i % NUMSKEWED] : "preset" + to_string(i);
+}
+
+int presetID(int i) {
+    return MINID + (i * 7919) % (MAXID - MINID);
+}
+
+// runs ops operations on each of the threads and returns the operations per second
+// a thread reads preloaded records and inserts and removes keys of its own,
+// in the skewed run it writes one of NUMSKEWED keys with IDs of its own
+// returns -1 when a lookup misses a preloaded record
+template <class CacheType>
+double runThreads(CacheType& cache, int threads, int ops, bool skewed) {
+    atomic<bool> failed(false);
+    vector<thread> workers;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(thread([&cache, &failed, t, ops, skewed]() {
+            XorShift rnd(t + 1);
+            int inserted = 0;
+            int removed = 0;
+            string prefix = "t" + to_string(t) + "-";
+            // the written keys differ from the preloaded ones, the thread number
+            // keeps the IDs of threads sharing a key apart
+            string skewedKey = "w" + SKEWEDKEYS[t % NUMSKEWED];
+            int idBase = MINID + t * 1000;
+            for (int op = 0; op < ops; op++) {
+                unsigned int r = rnd.next();
+                if (static_cast<int>(r % 100) < READPERCENT) {
+                    int i = (r >> 8) % PRELOAD;
+                    if (!cache.getPerson(presetKey(i, skewed), presetID(i)).getUsed()) {
+                        failed = true;
+                    }
+                } else if (r & 0x100 || removed == inserted) {
+                    if (skewed) {
+                        cache.insert(Person(skewedKey, idBase + inserted % 1000, true));
+                    } else {
+                        cache.insert(Person(prefix + to_string(inserted), MINID + inserted % 1000, true));
+                    }
+                    inserted++;
+                } else {
+                    if (skewed) {
+                        cache.remove(Person(skewedKey, idBase + removed % 1000, true));
+                    } else {
+                        cache.remove(Person(prefix + to_string(removed), MINID + removed % 1000, true));
+                    }
+                    removed++;
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (failed) {
+        return -1.0;
+    }
+    return threads * static_cast<double>(ops) / seconds;
+}
+
+template <class CacheType>
+void preload(CacheType& cache, bool skewed) {
+    for (int i = 0; i < PRELOAD; i++) {
+        cache.insert(Person(presetKey(i, skewed), presetID(i), true));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int maxThreads = static_cast<int>(thread::hardware_concurrency());
+    int ops = 200000;
+    if (argc > 1) {
+        maxThreads = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        ops = atoi(argv[2]);
+    }
+    if (maxThreads < 1) {
+        maxThreads = 1;
+    }
+
+    bool result = true;
+    // the skewed run uses COMPOSITEHASH, without it the records of a key and all
+    // the writes to them would go to a single shard
+    for (int run = 0; run < 2; run++) {
+        bool skewed = (run == 1);
+        hash_t hashing = skewed ? COMPOSITEHASH : KEYHASH;
+        cout << (skewed ? "Skewed keys (" + to_string(NUMSKEWED) + " keys, COMPOSITEHASH)" : string("Distinct keys"))
+             << ", " << READPERCENT << "% lookups, " << ops << " operations per thread" << endl;
+        cout << "threads\tone lock (ops/s)\tsharded (ops/s)\tsharded speedup over 1 thread" << endl;
+
+        double shardedBase = 0.0;
+        // powers of two below maxThreads, then maxThreads itself once
+        for (int threads = 1; ; threads = min(threads * 2, maxThreads)) {
+            LockedCache locked(PRELOAD * 2, hashing);
+            preload(locked, skewed);
+            double lockedRate = runThreads(locked, threads, ops, skewed);
+
+            ShardedCache sharded(PRELOAD * 2, hashCode, QUADRATIC, hashing);
+            preload(sharded, skewed);
+            double shardedRate = runThreads(sharded, threads, ops, skewed);
+
+            if (lockedRate < 0 || shardedRate < 0) {
+                result = false;
+            }
+            if (threads == 1) {
+                shardedBase = shardedRate;
+            }
+            cout << threads << "\t" << static_cast<long long>(lockedRate) << "\t\t\t"
+                 << static_cast<long long>(shardedRate) << "\t\t"
+                 << shardedRate / shardedBase << endl;
+
+            if (threads == maxThreads) {
+                break;      // the last run used all the threads
+            }
+        }
+        cout << endl;
+    }
+
+    cout << (result ? "All lookups found their records." : "FAILED: lookups missed records.") << endl;
+    return result ? 0 : 1;
+}
@@ -0,0 +1,271 @@
+// CMSC 341 - Fall 25 - Project 4
+// student: Andrew Soth
+// professor: Kartchner
+
+#include "shardedcache.h"
+
+// parameterized constructors - take either kind of hash function
+ShardedCache::ShardedCache(size_t size, hash_fn hash, prob_t probing, hash_t hashing, int shards){
+    m_viewHash = nullptr;
+    m_hash = hash;
+    createShards(size, probing, hashing, shards);
+}
+
+ShardedCache::ShardedCache(size_t size, hash_view_fn hash, prob_t probing, hash_t hashing, int shards){
+    m_viewHash = hash;
+    m_hash = nullptr;
+    createShards(size, probing, hashing, shards);
+}
+
+// rounds the number of shards up to a power of 2
+// and gives every shard its part of the initial capacity
+void ShardedCache::createShards(size_t size, prob_t probing, hash_t hashing, int shards){
+    m_hashing = hashing;
+    if (shards < 1) {
+        shards = 1;
+    } else if (shards > MAXSHARDS) {
+        shards = MAXSHARDS;
+    }
+    m_numShards = 1;
+    m_shardShift = 32;
+    while (m_numShards < shards) {
+        m_numShards *= 2;
+        m_shardShift--;
+    }
+
+    m_shards = new Shard[m_numShards];
+    for (int i = 0; i < m_numShards; i++) {
+        // a shard below MINPRIME gets MINPRIME from the Cache constructor
+        if (m_viewHash != nullptr) {
+            m_shards[i].m_cache = new Cache(size / m_numShards, m_viewHash, probing, hashing);
+        } else {
+            m_shards[i].m_cache = new Cache(size / m_numShards, m_hash, probing, hashing);
+        }
+        m_shards[i].m_cache->changeProbPolicy(probing);
+        m_shards[i].m_cache->setSharedReads(true);
+        m_shards[i].m_size = 0;
+    }
+}
+
+// destructor - deallocates every shard
+ShardedCache::~ShardedCache(){
+    for (int i = 0; i < m_numShards; i++) {
+        delete m_shards[i].m_cache;
+        m_shards[i].m_cache = nullptr;
+    }
+    delete[] m_shards;
+    m_shards = nullptr;
+}
+
+// inserts a Person object into its shard
+// returns true if insertion succeeds, false otherwise
+bool ShardedCache::insert(const Person& person){
+    return emplace(person.m_key, person.m_id);
+}
+
+// inserts the record (key, id) into its shard without a Person object
+bool ShardedCache::emplace(string_view key, int id){
+    unsigned int h = keyHash(key);
+    Shard& shard = shardOf(h, id);
+    if (!shard.m_cache->emplaceKeyed(key, id, h)) {
+        return false;
+    }
+    shard.m_size++;
+    return true;
+}
+
+// removes a Person object from its shard
+// returns true if successful, false otherwise
+bool ShardedCache::remove(const Person& person){
+    return remove(person.m_key, person.m_id);
+}
+
+// removes the record (key, id) from its shard
+bool ShardedCache::remove(string_view key, int id){
+    unsigned int h = keyHash(key);
+    Shard& shard = shardOf(h, id);
+    if (!shard.m_cache->removeKeyed(key, id, h)) {
+        return false;
+    }
+    shard.m_size--;
+    return true;
+}
+
+// searches the shard of the record for the Person object, without a lock
+const Person ShardedCache::getPerson(string_view key, int id) const{
+    unsigned int h = keyHash(key);
+    return shardOf(h, id).m_cache->getPersonKeyed(key, id, h);
+}
+
+// looks the key up in its shard without building a Person
+PersonView ShardedCache::getPersonView(string_view key, int id) const{
+    unsigned int h = keyHash(key);
+    return shardOf(h, id).m_cache->getPersonViewKeyed(key, id, h);
+}
+
+// updates the ID of a Person object, with KEYHASH the key and so the shard do not change
+// with COMPOSITEHASH the new ID may belong to another shard, then both shards are
+// locked, the one with the lower index first, and the record moves over
+bool ShardedCache::updateID(const Person& person, int ID){
+    unsigned int h = keyHash(person.m_key);
+    Shard& from = shardOf(h, person.m_id);
+    Shard& to = (ID < MINID || ID > MAXID) ? from : shardOf(h, ID);
+    if (&from == &to) {
+        return from.m_cache->updateIDKeyed(person, ID, h);
+    }
+    Shard& first = (&from < &to) ? from : to;
+    Shard& second = (&from < &to) ? to : from;
+    lock_guard<recursive_mutex> firstLock(first.m_cache->m_writeLock);
+    lock_guard<recursive_mutex> secondLock(second.m_cache->m_writeLock);
+    if (!from.m_cache->moveRecord(*to.m_cache, person, ID, h)) {
+        return false;
+    }
+    to.m_size++;
+    from.m_size--;
+    return true;
+}
+
+// passes the policy change on to every shard, each one switches at its next rehash
+void ShardedCache::changeProbPolicy(prob_t policy){
+    for (int i = 0; i < m_numShards; i++) {
+        m_shards[i].m_cache->changeProbPolicy(policy);
+    }
+}
+
+// returns the number of shards
+int ShardedCache::numShards() const{
+    return m_numShards;
+}
+
+// returns the number of live records, the shards are counted one at a time
+// so writers running meanwhile may or may not be included
+size_t ShardedCache::size() const{
+    size_t total = 0;
+    for (int i = 0; i < m_numShards; i++) {
+        total += m_shards[i].m_size.load();
+    }
+    return total;
+}
+
+// adds up the counters of every shard
+CacheMetrics ShardedCache::metrics() const{
+    CacheMetrics total = m_shards[0].m_cache->metrics();
+    for (int i = 1; i < m_numShards; i++) {
+        CacheMetrics shard = m_shards[i].m_cache->metrics();
+        total.m_lookups += shard.m_lookups;
+        total.m_hits += shard.m_hits;
+        total.m_misses += shard.m_misses;
+        total.m_inserts += shard.m_inserts;
+        total.m_removes += shard.m_removes;
+        total.m_updates += shard.m_updates;
+        total.m_searches += shard.m_searches;
+        total.m_probes += shard.m_probes;
+        total.m_tombstoneReuses += shard.m_tombstoneReuses;
+        total.m_loadRehashes += shard.m_loadRehashes;
+        total.m_deletedRehashes += shard.m_deletedRehashes;
+        total.m_migrated += shard.m_migrated;
+        total.m_migrateNanos += shard.m_migrateNanos;
+        total.m_lookupRetries += shard.m_lookupRetries;
+        total.m_backoffLookups += shard.m_backoffLookups;
+    }
+    return total;
+}
+
+// sets the counters of every shard back to 0
+void ShardedCache::resetMetrics(){
+    for (int i = 0; i < m_numShards; i++) {
+        m_shards[i].m_cache->resetMetrics();
+    }
+}
+
+// adds up the bytes of every shard
+CacheMemory ShardedCache::memoryUsage() const{
+    CacheMemory total = m_shards[0].m_cache->memoryUsage();
+    for (int i = 1; i < m_numShards; i++) {
+        CacheMemory shard = m_shards[i].m_cache->memoryUsage();
+        total.m_records += shard.m_records;
+        total.m_slotBytes += shard.m_slotBytes;
+        total.m_ctrlBytes += shard.m_ctrlBytes;
+        total.m_keyBytes += shard.m_keyBytes;
+        total.m_keyUsed += shard.m_keyUsed;
+        total.m_totalBytes += shard.m_totalBytes;
+    }
+    total.m_bytesPerRecord = (total.m_records == 0) ? 0.0
+                             : static_cast<double>(total.m_totalBytes) / total.m_records;
+    return total;
+}
+
+// turns latency tracking on or off in every shard
+// must not be switched while other threads use the cache
+void ShardedCache::setLatencyTracking(bool on){
+    for (int i = 0; i < m_numShards; i++) {
+        m_shards[i].m_cache->setLatencyTracking(on);
+    }
+}
+
+// the percentiles come from the histograms of all the shards added up
+LatencySummary ShardedCache::latency(op_t op) const{
+    LatencyHistogram total;
+    for (int i = 0; i < m_numShards; i++) {
+        const LatencyHistogram* shard = m_shards[i].m_cache->m_latency;
+        if (shard != nullptr) {
+            total.merge(shard[op]);
+        }
+    }
+    return total.summary();
+}
+
+void ShardedCache::writeLatency(ostream& out, stats_t format) const{
+    LatencySummary summaries[NUMOPS];
+    for (int op = 0; op < NUMOPS; op++) {
+        summaries[op] = latency(static_cast<op_t>(op));
+    }
+    Cache::writeLatency(out, summaries, format);
+}
+
+void ShardedCache::resetLatency(){
+    for (int i = 0; i < m_numShards; i++) {
+        m_shards[i].m_cache->resetLatency();
+    }
+}
+
+// the shards write to the same recorder, which keeps their lines apart
+void ShardedCache::setTraceRecorder(TraceRecorder* recorder){
+    for (int i = 0; i < m_numShards; i++) {
+        m_shards[i].m_cache->setTraceRecorder(recorder);
+    }
+}
+
+// dumps the tables of every shard
+// used for debugging
+void ShardedCache::dump() const{
+    for (int i = 0; i < m_numShards; i++) {
+        cout << "Shard " << i << ":" << endl;
+        m_shards[i].m_cache->dump();
+    }
+}
+
+/*************************************
+********** Private Functions**********
+*************************************/
+
+// calls the hash function on a key, the shard gets the result passed on
+// so every operation hashes its key once
+unsigned int ShardedCache::keyHash(string_view key) const{
+    return (m_viewHash != nullptr) ? m_viewHash(key) : m_hash(string(key));
+}
+
+// returns the shard of the record (key, id) from the hash of its key
+// with COMPOSITEHASH the ID is mixed in as for the bucket hash of the record
+// the hash is finalized first and the shard comes from its top bits,
+// so the shard says nothing about the bucket the record gets inside it
+ShardedCache::Shard& ShardedCache::shardOf(unsigned int keyHash, int id) const{
+    if (m_numShards == 1) {
+        return m_shards[0];
+    }
+    unsigned int h = keyHash;
+    if (m_hashing == COMPOSITEHASH) {
+        h = m_shards[0].m_cache->combineID(keyHash, id);
+    }
+    return m_shards[mix32(h) >> m_shardShift];
+}
@@ -0,0 +1,75 @@
+// CMSC 341 - Fall 25 - Project 4
+#ifndef SHARDEDCACHE_H
+#define SHARDEDCACHE_H
+#include "cache.h"
+class Grader;   // forward declaration, will be used for grdaing
+class Tester;   // forward declaration, will be used for testing
+const int DEFSHARDS = 64;   // default number of shards, rounded up to a power of 2
+const int MAXSHARDS = 4096;
+// size of a cache line, shards are aligned to it so that their counters do not share one
+const int CACHELINE = 64;
+
+// a set of independent Cache tables that can be used from many threads at once
+// a record lives in the shard picked by the hash of its key, so all the records
+// of one key (and an updateID) stay in one shard, and every shard has its own
+// writer lock and its own incremental rehash
+// with COMPOSITEHASH the shard comes from the (key, ID) hash instead, so a few
+// keys with many IDs each spread over all the shards, and an updateID may move
+// the record to another shard
+// the shards run with shared reads, lookups take no lock at all
+class ShardedCache{
+    public:
+    friend class Grader;
+    friend class Tester;
+    // size is the total initial capacity, spread over the shards
+    ShardedCache(size_t size, hash_fn hash, prob_t probing = DEFPOLCY, hash_t hashing = DEFHASH,
+                 int shards = DEFSHARDS);
+    ShardedCache(size_t size, hash_view_fn hash, prob_t probing = DEFPOLCY, hash_t hashing = DEFHASH,
+                 int shards = DEFSHARDS);
+    ~ShardedCache();
+    bool insert(const Person& person);
+    bool emplace(string_view key, int id);
+    bool remove(const Person& person);
+    bool remove(string_view key, int id);
+    const Person getPerson(string_view key, int id) const;
+    // see Cache::getPersonView, a view from a shard always refers to the key passed in
+    PersonView getPersonView(string_view key, int id) const;
+    bool updateID(const Person& person, int ID);
+    void changeProbPolicy(prob_t policy);
+    int numShards() const;
+    // number of live records over all the shards
+    size_t size() const;
+    // counters of all the shards added up
+    CacheMetrics metrics() const;
+    void resetMetrics();
+    // bytes of all the shards added up
+    CacheMemory memoryUsage() const;
+    // latency histograms of every shard, summed up for the percentiles
+    void setLatencyTracking(bool on);
+    LatencySummary latency(op_t op) const;
+    void writeLatency(ostream& out, stats_t format) const;
+    void resetLatency();
+    // attaches the recorder to every shard, see Cache::setTraceRecorder
+    void setTraceRecorder(TraceRecorder* recorder);
+    void dump() const;
+    private:
+    // one shard, on cache lines of its own
+    // the writer lock of the shard is the one inside its Cache
+    struct alignas(CACHELINE) Shard{
+        Cache*          m_cache;    // the hash table of the shard
+        // written by every writer, kept off the line lookups read m_cache from
+        alignas(CACHELINE) atomic<size_t> m_size;   // live records in the shard
+    };
+
+    hash_view_fn m_viewHash;    // hash function, nullptr if m_hash is used
+    hash_fn    m_hash;          // hash function of the old signature
+    hash_t     m_hashing;       // KEYHASH picks the shard by key, COMPOSITEHASH by (key, ID)
+    Shard*     m_shards;        // array of shards
+    int        m_numShards;     // number of shards, a power of 2
+    int        m_shardShift;    // 32 - log2(m_numShards)
+
+    void createShards(size_t size, prob_t probing, hash_t hashing, int shards);
+    unsigned int keyHash(string_view key) const;
+    Shard& shardOf(unsigned int keyHash, int id) const;
+};
+#endif